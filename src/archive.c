@@ -0,0 +1,92 @@
+/*
+Create, list and extract archives of many encoded images
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#include <ctype.h>
+#include "archive.h"
+#include "file.h"
+
+int create(char *name, char *list, int wavelet)
+{
+	long long size;
+	unsigned char *data = read_file(list, &size);
+	if (!data)
+		return 1;
+	char *text = realloc(data, size + 1);
+	text[size] = 0;
+	char **inputs = malloc(sizeof(char *) * (size / 2 + 1));
+	int count = 0;
+	for (char *c = text; *c;) {
+		while (*c && isspace(*c))
+			*c++ = 0;
+		if (!*c)
+			break;
+		inputs[count++] = c;
+		while (*c && *c != '\n')
+			++c;
+		for (char *e = c - 1; isspace(*e); --e)
+			*e = 0;
+	}
+	int ok = create_archive(name, inputs, count, wavelet);
+	free(inputs);
+	free(text);
+	return !ok;
+}
+
+int list(char *name)
+{
+	struct archive *archive = open_archive(name);
+	if (!archive)
+		return 1;
+	printf("id,width,height,bytes\n");
+	for (int id = 0; id < archive->count; ++id) {
+		unsigned char *entry = archive->map + ARCHIVE_HEADER + ARCHIVE_ENTRY * (long long)id;
+		printf("%d,%lld,%lld,%lld\n", id, read_le(entry + 8, 4), read_le(entry + 12, 4),
+			archive_offset(archive, id + 1) - archive_offset(archive, id));
+	}
+	close_archive(archive);
+	return 0;
+}
+
+int extract(char *name, int id, char *output)
+{
+	struct archive *archive = open_archive(name);
+	if (!archive)
+		return 1;
+	struct decoder *dec = new_decoder(0, 0, 0);
+	if (!dec) {
+		close_archive(archive);
+		return 1;
+	}
+	struct image *image = decode_archived(dec, archive, id);
+	int ok = 0;
+	if (image) {
+		image->name = output;
+		ok = write_image(image);
+	} else {
+		fprintf(stderr, "could not decode entry %d of \"%s\".\n", id, name);
+	}
+	delete_decoder(dec);
+	close_archive(archive);
+	return !ok;
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 4 || argc == 5) && !strcmp(argv[1], "create")) {
+		int wavelet = argc == 5 ? parse_wavelet(argv[4]) : 1;
+		if (!wavelet_supported(wavelet))
+			return 1;
+		return create(argv[2], argv[3], wavelet);
+	}
+	if (argc == 3 && !strcmp(argv[1], "list"))
+		return list(argv[2]);
+	if (argc == 5 && !strcmp(argv[1], "extract"))
+		return extract(argv[2], atoi(argv[3]), argv[4]);
+	fprintf(stderr, "usage: %s create archive.dwta list.txt [WAVELET|auto]\n", argv[0]);
+	fprintf(stderr, "       %s list archive.dwta\n", argv[0]);
+	fprintf(stderr, "       %s extract archive.dwta ID output.ppm|output.y4m\n", argv[0]);
+	return 1;
+}
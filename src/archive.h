@@ -0,0 +1,168 @@
+/*
+Archive of many encoded images with an index for random access
+
+Layout, all numbers in little endian:
+  header: "DWTA", 4 bytes count, 2 bytes maxval, wavelet, lmin, sampling, channels,
+    decorrelation, 3 zero bytes
+  index: count entries of 8 bytes offset, 4 bytes width and 4 bytes height
+  end: 8 bytes offset behind the last entry
+  data: the encoded images without their parameters, which come from above
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "encoder.h"
+#include "decoder.h"
+#include "picture.h"
+
+enum { ARCHIVE_HEADER = 20, ARCHIVE_ENTRY = 16 };
+
+struct archive {
+	unsigned char *map;
+	long long size;
+	int count, maxval, wavelet, lmin, sampling, channels, decorrelation;
+};
+
+long long archive_offset(struct archive *archive, int id)
+{
+	return read_le(archive->map + ARCHIVE_HEADER + ARCHIVE_ENTRY * (long long)id, 8);
+}
+
+struct archive *open_archive(char *name)
+{
+	int fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+		return 0;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size >= ARCHIVE_HEADER + 8)
+		map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "could not map \"%s\" file.\n", name);
+		return 0;
+	}
+	struct archive *archive = malloc(sizeof(struct archive));
+	archive->map = map;
+	archive->size = st.st_size;
+	archive->count = read_le(archive->map + 4, 4);
+	archive->maxval = read_le(archive->map + 8, 2);
+	archive->wavelet = archive->map[10];
+	archive->lmin = archive->map[11];
+	archive->sampling = archive->map[12];
+	archive->channels = archive->map[13];
+	archive->decorrelation = archive->map[14];
+	long long index = ARCHIVE_HEADER + ARCHIVE_ENTRY * (long long)archive->count + 8;
+	if (memcmp(archive->map, "DWTA", 4) || archive->count < 0 || archive->wavelet > 2 || !archive->maxval ||
+	index > archive->size || archive_offset(archive, archive->count) > archive->size) {
+		fprintf(stderr, "\"%s\" is not a valid archive.\n", name);
+		munmap(archive->map, archive->size);
+		free(archive);
+		return 0;
+	}
+	return archive;
+}
+
+void close_archive(struct archive *archive)
+{
+	munmap(archive->map, archive->size);
+	free(archive);
+}
+
+struct image *decode_archived(struct decoder *dec, struct archive *archive, int id)
+{
+	if (id < 0 || id >= archive->count)
+		return 0;
+	unsigned char *entry = archive->map + ARCHIVE_HEADER + ARCHIVE_ENTRY * (long long)id;
+	long long offset = read_le(entry, 8), end = archive_offset(archive, id + 1);
+	if (offset < ARCHIVE_HEADER || offset > end || end > archive->size)
+		return 0;
+	dec->shared = 1;
+	dec->wavelet = archive->wavelet;
+	dec->lmin = archive->lmin;
+	dec->maxval = archive->maxval;
+	dec->sampling = archive->sampling;
+	dec->channels = archive->channels;
+	dec->decorrelation = archive->decorrelation;
+	dec->width = read_le(entry + 8, 4);
+	dec->height = read_le(entry + 12, 4);
+	struct image *image = decode_image(dec, archive->map + offset, end - offset);
+	dec->shared = 0;
+	return image;
+}
+
+// wavelet -1 chooses one for all entries from the first image
+int create_archive(char *name, char **inputs, int count, int wavelet)
+{
+	FILE *file = fopen(name, "w");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", name);
+		return 0;
+	}
+	struct encoder *enc = new_encoder(0, 0, 0);
+	if (!enc) {
+		fclose(file);
+		return 0;
+	}
+	long long index = ARCHIVE_ENTRY * (long long)count + 8;
+	unsigned char *head = calloc(ARCHIVE_HEADER + index, 1);
+	memcpy(head, "DWTA", 4);
+	write_le(head + 4, count, 4);
+	int ok = fwrite(head, 1, ARCHIVE_HEADER + index, file) == (size_t)(ARCHIVE_HEADER + index);
+	long long offset = ARCHIVE_HEADER + index;
+	enc->shared = 1;
+	for (int id = 0; ok && id < count; ++id) {
+		struct image *image = read_image(inputs[id]);
+		if (!image) {
+			ok = 0;
+			break;
+		}
+		if (!id) {
+			write_le(head + 8, image->maxval, 2);
+			head[12] = image->sampling;
+			head[13] = image->channels;
+			if (wavelet < 0 && (wavelet = choose_wavelet(enc, image, 0)) < 0) {
+				delete_image(image);
+				ok = 0;
+				break;
+			}
+			head[10] = wavelet;
+		} else if (image->maxval != read_le(head + 8, 2) || image->sampling != head[12] || image->channels != head[13]) {
+			fprintf(stderr, "\"%s\" does not share maxval, sampling and channels of the archive.\n", inputs[id]);
+			delete_image(image);
+			ok = 0;
+			break;
+		}
+		unsigned char *entry = head + ARCHIVE_HEADER + ARCHIVE_ENTRY * (long long)id;
+		write_le(entry, offset, 8);
+		write_le(entry + 8, image->width, 4);
+		write_le(entry + 12, image->height, 4);
+		long long bytes = encode_image(enc, image, 0, wavelet);
+		head[11] = enc->lmin;
+		head[14] = enc->decorrelation;
+		delete_image(image);
+		ok = bytes >= 0 && fwrite(enc->data, 1, bytes, file) == (size_t)bytes;
+		offset += bytes;
+	}
+	delete_encoder(enc);
+	write_le(head + ARCHIVE_HEADER + index - 8, offset, 8);
+	if (ok)
+		ok = !fseek(file, 0, SEEK_SET) && fwrite(head, 1, ARCHIVE_HEADER + index, file) == (size_t)(ARCHIVE_HEADER + index);
+	free(head);
+	if (fclose(file) || !ok) {
+		fprintf(stderr, "could not write archive \"%s\".\n", name);
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,134 @@
+/*
+Process a list of jobs on a pool of worker threads
+
+Each worker runs whole jobs, from reading to writing, with a codec context
+of its own, so the I/O of one picture overlaps the coding of others
+without passing pictures and their buffers between threads.
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "file.h"
+
+struct batch {
+	char *text;
+	char **args;
+	int *argc;
+	int jobs, next, failed;
+	double pixels;
+	pthread_mutex_t mutex;
+	void *(*init)(void);
+	long long (*work)(void *, int, char **);
+	void (*done)(void *);
+};
+
+double batch_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void *batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+	void *ctx = batch->init();
+	while (1) {
+		pthread_mutex_lock(&batch->mutex);
+		int job = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+		if (job >= batch->jobs)
+			break;
+		// without its context the worker can only fail the jobs it takes
+		long long pixels = ctx ? batch->work(ctx, batch->argc[job], batch->args + 4 * job) : -1;
+		pthread_mutex_lock(&batch->mutex);
+		if (pixels < 0)
+			++batch->failed;
+		else
+			batch->pixels += pixels;
+		pthread_mutex_unlock(&batch->mutex);
+	}
+	if (ctx)
+		batch->done(ctx);
+	return 0;
+}
+
+int run_batch(char *name, int threads, void *(*init)(void), long long (*work)(void *, int, char **), void (*done)(void *))
+{
+	long long size;
+	unsigned char *data = read_file(name, &size);
+	if (!data)
+		return 1;
+	struct batch batch;
+	char *text = realloc(data, size + 1);
+	batch.text = text ? text : (char *)data;
+	batch.args = malloc(sizeof(char *) * 4 * (size / 2 + 1));
+	batch.argc = malloc(sizeof(int) * (size / 2 + 1));
+	if (!text || !batch.args || !batch.argc) {
+		fprintf(stderr, "could not allocate memory for \"%s\" batch.\n", name);
+		free(batch.text);
+		free(batch.args);
+		free(batch.argc);
+		return 1;
+	}
+	batch.text[size] = 0;
+	batch.jobs = 0;
+	for (char *line = batch.text, *next; *line; line = next) {
+		for (next = line; *next && *next != '\n'; ++next);
+		if (*next)
+			*next++ = 0;
+		int argc = 0;
+		for (char *c = line; *c && argc < 4;) {
+			while (*c && isspace(*c))
+				*c++ = 0;
+			if (!*c)
+				break;
+			batch.args[4*batch.jobs+argc++] = c;
+			while (*c && !isspace(*c))
+				++c;
+		}
+		if (argc)
+			batch.argc[batch.jobs++] = argc;
+	}
+	batch.next = 0;
+	batch.failed = 0;
+	batch.pixels = 0;
+	batch.init = init;
+	batch.work = work;
+	batch.done = done;
+	pthread_mutex_init(&batch.mutex, 0);
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > batch.jobs)
+		threads = batch.jobs;
+	pthread_t *pool = malloc(sizeof(pthread_t) * threads);
+	double start = batch_seconds();
+	int started = 0;
+	while (pool && started < threads && !pthread_create(pool + started, 0, batch_worker, &batch))
+		++started;
+	// the calling thread takes the jobs of the workers that could not be started
+	if (started < threads) {
+		batch_worker(&batch);
+		threads = started + 1;
+	}
+	for (int i = 0; i < started; ++i)
+		pthread_join(pool[i], 0);
+	double seconds = batch_seconds() - start;
+	pthread_mutex_destroy(&batch.mutex);
+	int images = batch.jobs - batch.failed;
+	fprintf(stderr, "%d images (%d failed) in %.3f seconds on %d threads: %.1f images/s, %.2f MPix/s\n",
+		images, batch.failed, seconds, threads, images / seconds, batch.pixels / seconds / 1000000.0);
+	free(pool);
+	free(batch.args);
+	free(batch.argc);
+	free(batch.text);
+	return batch.failed != 0;
+}
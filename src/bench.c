@@ -0,0 +1,225 @@
+/*
+Benchmark the stages of the codec on synthetic and given pictures
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "encoder.h"
+#include "decoder.h"
+#include "picture.h"
+#include "synth.h"
+
+struct bench {
+	struct encoder *enc;
+	struct decoder *dec;
+	struct image *image;
+	char *temp;
+	int wavelet;
+	long long bytes;
+};
+
+double bench_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+double bench_write_ppm(struct bench *b)
+{
+	char *name = b->image->name;
+	b->image->name = b->temp;
+	double start = bench_seconds();
+	write_ppm(b->image);
+	double seconds = bench_seconds() - start;
+	b->image->name = name;
+	return seconds;
+}
+
+double bench_read_ppm(struct bench *b)
+{
+	double start = bench_seconds();
+	struct image *image = read_ppm(b->temp);
+	double seconds = bench_seconds() - start;
+	if (image)
+		delete_image(image);
+	return seconds;
+}
+
+double bench_rct_from_srgb(struct bench *b)
+{
+	double start = bench_seconds();
+	for (int chan = 0; chan < 3; ++chan)
+		forward_copy(b->enc->input, b->image, chan, b->enc->decorrelation);
+	return bench_seconds() - start;
+}
+
+double bench_dwt2d(struct bench *b)
+{
+	struct encoder *enc = b->enc;
+	double seconds = 0;
+	for (int chan = 0; chan < 3; ++chan) {
+		int w = enc->widths[chan][enc->levels[chan]], h = enc->heights[chan][enc->levels[chan]];
+		forward_copy(enc->input, b->image, chan, enc->decorrelation);
+		double start = bench_seconds();
+		forward_transformation(enc->output, enc->input, enc->levels_x[chan], enc->levels_y[chan], w, h, b->wavelet);
+		seconds += bench_seconds() - start;
+	}
+	return seconds;
+}
+
+double bench_quantization(struct bench *b)
+{
+	struct encoder *enc = b->enc;
+	double seconds = 0;
+	for (int chan = 0; chan < 3; ++chan) {
+		int w = enc->widths[chan][enc->levels[chan]], h = enc->heights[chan][enc->levels[chan]];
+		forward_copy(enc->input, b->image, chan, enc->decorrelation);
+		float *coeffs = forward_transformation(enc->output, enc->input, enc->levels_x[chan], enc->levels_y[chan], w, h, b->wavelet);
+		double start = bench_seconds();
+		forward_quantization(enc->buffer+enc->offsets[chan], coeffs, enc->widths[chan], enc->heights[chan], enc->lengths[chan], enc->steps[chan], enc->levels[chan]);
+		seconds += bench_seconds() - start;
+	}
+	return seconds;
+}
+
+double bench_encode(struct bench *b)
+{
+	transform_image(b->enc, b->image, b->wavelet);
+	double start = bench_seconds();
+	b->bytes = code_image(b->enc, 0);
+	return bench_seconds() - start;
+}
+
+double bench_decode(struct bench *b)
+{
+	double start = bench_seconds();
+	decode_coefficients(b->dec, b->enc->data, b->bytes);
+	return bench_seconds() - start;
+}
+
+double bench_idwt2d(struct bench *b)
+{
+	struct decoder *dec = b->dec;
+	double seconds = 0;
+	for (int chan = 0; chan < 3; ++chan) {
+		int w = dec->widths[chan][dec->levels[chan]], h = dec->heights[chan][dec->levels[chan]];
+		inverse_quantization(dec->input, dec->coeffs[chan], dec->compact[chan], dec->missing[chan], dec->widths[chan], dec->heights[chan], dec->lengths[chan], dec->steps[chan], dec->levels[chan], dec->wavelet);
+		double start = bench_seconds();
+		inverse_transformation(dec->output, dec->input, dec->levels_x[chan], dec->levels_y[chan], w, h, dec->wavelet);
+		seconds += bench_seconds() - start;
+	}
+	return seconds;
+}
+
+double bench_srgb_from_rct(struct bench *b)
+{
+	struct decoder *dec = b->dec;
+	double start = bench_seconds();
+	srgb_planes_from_rct(&dec->image, dec->buffer, dec->buffer+dec->offsets[1], dec->buffer+dec->offsets[2]);
+	return bench_seconds() - start;
+}
+
+void bench_stage(struct bench *b, char *stage, double (*func)(struct bench *), int repeats, char *wavelet)
+{
+	double best = func(b);
+	for (int i = 1; i < repeats; ++i) {
+		double seconds = func(b);
+		if (best > seconds)
+			best = seconds;
+	}
+	struct image *image = b->image;
+	printf("%s,%d,%d,%s,%s,%.9f,%.3f\n", image->name, image->width, image->height,
+		wavelet, stage, best, image->total / best / 1000000.0);
+	fflush(stdout);
+}
+
+void bench_image(struct image *image, char *temp, int repeats)
+{
+	char *wavelets[3] = { "haar", "cdf97", "rint_haar" };
+	struct bench b;
+	b.image = image;
+	b.temp = temp;
+	b.enc = new_encoder(image->width, image->height, image->maxval);
+	b.dec = new_decoder(image->width, image->height, image->maxval);
+	if (!b.enc || !b.dec) {
+		if (b.enc)
+			delete_encoder(b.enc);
+		if (b.dec)
+			delete_decoder(b.dec);
+		return;
+	}
+	bench_stage(&b, "write_ppm", bench_write_ppm, repeats, "none");
+	bench_stage(&b, "read_ppm", bench_read_ppm, repeats, "none");
+	for (int wavelet = 0; wavelet < 3; ++wavelet) {
+		b.wavelet = wavelet;
+		transform_image(b.enc, image, wavelet);
+		bench_stage(&b, "rct_from_srgb", bench_rct_from_srgb, repeats, wavelets[wavelet]);
+		bench_stage(&b, "dwt2d", bench_dwt2d, repeats, wavelets[wavelet]);
+		bench_stage(&b, "quantization", bench_quantization, repeats, wavelets[wavelet]);
+		bench_stage(&b, "encode", bench_encode, repeats, wavelets[wavelet]);
+		bench_stage(&b, "decode", bench_decode, repeats, wavelets[wavelet]);
+		bench_stage(&b, "idwt2d", bench_idwt2d, repeats, wavelets[wavelet]);
+		bench_stage(&b, "srgb_from_rct", bench_srgb_from_rct, repeats, wavelets[wavelet]);
+	}
+	delete_encoder(b.enc);
+	delete_decoder(b.dec);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && (argv[1][0] < '0' || argv[1][0] > '9')) {
+		fprintf(stderr, "usage: %s [REPEATS] [input.ppm ...]\n", argv[0]);
+		return 1;
+	}
+	int repeats = 3;
+	if (argc >= 2)
+		repeats = atoi(argv[1]);
+	if (repeats < 1)
+		repeats = 1;
+	char temp[] = "/tmp/dwtbench-XXXXXX";
+	int fd = mkstemp(temp);
+	if (fd < 0) {
+		fprintf(stderr, "could not create temporary file.\n");
+		return 1;
+	}
+	close(fd);
+	printf("image,width,height,wavelet,stage,seconds,mpix_per_s\n");
+	if (argc >= 3) {
+		for (int i = 2; i < argc; ++i) {
+			struct image *image = read_image(argv[i]);
+			if (!image)
+				continue;
+			if (image->channels == 3 && !image->sampling)
+				bench_image(image, temp, repeats);
+			else
+				fprintf(stderr, "skipping \"%s\", only RGB pictures supported.\n", argv[i]);
+			delete_image(image);
+		}
+	} else {
+		struct { char *name; void (*func)(struct image *); } kinds[4] = {
+			{ "noise", synth_noise }, { "gradient", synth_gradient },
+			{ "bars", synth_bars }, { "natural", synth_natural },
+		};
+		int sizes[5][2] = { { 256, 256 }, { 1000, 750 }, { 1920, 1080 }, { 2048, 64 }, { 97, 2049 } };
+		for (int s = 0; s < 5; ++s) {
+			for (int k = 0; k < 4; ++k) {
+				char name[64];
+				snprintf(name, sizeof(name), "%s-%dx%d", kinds[k].name, sizes[s][0], sizes[s][1]);
+				struct image *image = new_planar_image(name, sizes[s][0], sizes[s][1], 3, 255, 0);
+				if (!image)
+					continue;
+				kinds[k].func(image);
+				bench_image(image, temp, repeats);
+				delete_image(image);
+			}
+		}
+	}
+	unlink(temp);
+	return 0;
+}
@@ -1,5 +1,5 @@
 /*
-Read and write bits to and from a file
+Read and write bits to and from a memory buffer
 
 Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 */
@@ -7,72 +7,79 @@ Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 #pragma once
 
 #include <stdlib.h>
-#include <stdio.h>
 
 struct bits_reader {
-	FILE *file;
-	char *name;
+	unsigned char *buf;
+	long long size;
+	long long pos;
 	int acc;
 	int cnt;
 };
 
 struct bits_writer {
-	FILE *file;
-	char *name;
+	unsigned char *buf;
+	long long size;
 	int acc;
 	int cnt;
-	int cap;
-	int num;
+	long long cap;
+	long long num;
 };
 
-struct bits_reader *bits_reader(char *name)
+void reset_bits_reader(struct bits_reader *bits, unsigned char *buf, long long size)
 {
-	FILE *file = fopen(name, "r");
-	if (!file) {
-		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
-		return 0;
-	}
-	struct bits_reader *bits = malloc(sizeof(struct bits_reader));
-	bits->file = file;
-	bits->name = name;
+	bits->buf = buf;
+	bits->size = size;
+	bits->pos = 0;
 	bits->acc = 0;
 	bits->cnt = 0;
-	return bits;
 }
 
-struct bits_writer *bits_writer(char *name, int capacity)
+void reset_bits_writer(struct bits_writer *bits, long long capacity)
 {
-	FILE *file = fopen(name, "w");
-	if (!file) {
-		fprintf(stderr, "could not open \"%s\" file to write.\n", name);
-		return 0;
-	}
-	struct bits_writer *bits = malloc(sizeof(struct bits_writer));
-	bits->file = file;
-	bits->name = name;
 	bits->acc = 0;
 	bits->cnt = 0;
 	bits->cap = capacity;
 	bits->num = 0;
+}
+
+struct bits_reader *bits_reader(unsigned char *buf, long long size)
+{
+	struct bits_reader *bits = malloc(sizeof(struct bits_reader));
+	reset_bits_reader(bits, buf, size);
 	return bits;
 }
 
-int bits_count(struct bits_writer *bits)
+struct bits_writer *bits_writer(unsigned char *buf, long long size, long long capacity)
+{
+	struct bits_writer *bits = malloc(sizeof(struct bits_writer));
+	bits->buf = buf;
+	bits->size = size;
+	reset_bits_writer(bits, capacity);
+	return bits;
+}
+
+long long bits_count(struct bits_writer *bits)
 {
 	return bits->num * 8 + bits->cnt;
 }
 
-void close_reader(struct bits_reader *bits)
+long long bits_flush(struct bits_writer *bits)
+{
+	if (bits->cnt && bits->num < bits->size) {
+		bits->buf[bits->num++] = bits->acc;
+		bits->acc = 0;
+		bits->cnt = 0;
+	}
+	return bits->num;
+}
+
+void delete_bits_reader(struct bits_reader *bits)
 {
-	fclose(bits->file);
 	free(bits);
 }
 
-void close_writer(struct bits_writer *bits)
+void delete_bits_writer(struct bits_writer *bits)
 {
-	if (bits->cnt && bits->acc != fputc(bits->acc, bits->file))
-		fprintf(stderr, "could not write to file \"%s\".\n", bits->name);
-	fclose(bits->file);
 	free(bits);
 }
 
@@ -80,16 +87,13 @@ int put_bit(struct bits_writer *bits, int b)
 {
 	if (bits->cap > 0 && bits->num * 8 + bits->cnt >= bits->cap)
 		return -2;
+	if (bits->num >= bits->size)
+		return -2;
 	bits->acc |= !!b << bits->cnt++;
 	if (bits->cnt >= 8) {
 		bits->cnt -= 8;
-		bits->num += 1;
-		int c = bits->acc & 255;
+		bits->buf[bits->num++] = bits->acc;
 		bits->acc >>= 8;
-		if (c != fputc(c, bits->file)) {
-			fprintf(stderr, "could not write to file \"%s\".\n", bits->name);
-			return -1;
-		}
 	}
 	return 0;
 }
@@ -107,12 +111,9 @@ int write_bits(struct bits_writer *bits, int b, int n)
 int get_bit(struct bits_reader *bits)
 {
 	if (!bits->cnt) {
-		int c = fgetc(bits->file);
-		if (c == EOF) {
-			fprintf(stderr, "could not read from file \"%s\".\n", bits->name);
+		if (bits->pos >= bits->size)
 			return -1;
-		}
-		bits->acc = c;
+		bits->acc = bits->buf[bits->pos++];
 		bits->cnt = 8;
 	}
 	int b = bits->acc & 1;
@@ -133,4 +134,3 @@ int read_bits(struct bits_reader *bits, int *b, int n)
 	*b = a;
 	return 0;
 }
-
@@ -0,0 +1,147 @@
+/*
+Least recently used cache of decoded coefficients and renditions
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+
+/*
+An entry holds either the decoded coefficients of a stream, with a copy
+of the decoder state to resume from, or, for reduce >= 0, the samples of
+one rendition of it.
+*/
+struct cache_entry {
+	struct cache_entry *prev, *next;
+	char *name;
+	long long mtime, size, bytes;
+	int reduce, drop;
+	struct decoder *state;
+	void *coeffs;
+	struct image image;
+};
+
+struct cache {
+	struct cache_entry *first, *last;
+	long long bytes, limit;
+};
+
+struct cache *new_cache(long long limit)
+{
+	struct cache *cache = malloc(sizeof(struct cache));
+	cache->first = 0;
+	cache->last = 0;
+	cache->bytes = 0;
+	cache->limit = limit;
+	return cache;
+}
+
+void unlink_entry(struct cache *cache, struct cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->first = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->last = entry->prev;
+	cache->bytes -= entry->bytes;
+}
+
+void push_entry(struct cache *cache, struct cache_entry *entry)
+{
+	entry->prev = 0;
+	entry->next = cache->first;
+	if (cache->first)
+		cache->first->prev = entry;
+	else
+		cache->last = entry;
+	cache->first = entry;
+	cache->bytes += entry->bytes;
+}
+
+void delete_entry(struct cache_entry *entry)
+{
+	free(entry->name);
+	free(entry->state);
+	free(entry->coeffs);
+	free(entry->image.planes);
+	free(entry);
+}
+
+void delete_cache(struct cache *cache)
+{
+	while (cache->first) {
+		struct cache_entry *entry = cache->first;
+		unlink_entry(cache, entry);
+		delete_entry(entry);
+	}
+	free(cache);
+}
+
+// returns the matching entry and marks it as the most recently used
+struct cache_entry *find_entry(struct cache *cache, char *name, long long mtime, long long size, int reduce, int drop)
+{
+	for (struct cache_entry *entry = cache->first; entry; entry = entry->next) {
+		if (entry->reduce != reduce || entry->drop != drop || entry->mtime != mtime ||
+		entry->size != size || strcmp(entry->name, name))
+			continue;
+		unlink_entry(cache, entry);
+		push_entry(cache, entry);
+		return entry;
+	}
+	return 0;
+}
+
+// evicts the least recently used entries, but never the one just inserted
+void insert_entry(struct cache *cache, struct cache_entry *entry)
+{
+	push_entry(cache, entry);
+	while (cache->bytes > cache->limit && cache->last != entry) {
+		struct cache_entry *old = cache->last;
+		unlink_entry(cache, old);
+		delete_entry(old);
+	}
+}
+
+struct cache_entry *new_entry(char *name, long long mtime, long long size, int reduce, int drop)
+{
+	struct cache_entry *entry = calloc(1, sizeof(struct cache_entry));
+	entry->name = strdup(name);
+	entry->mtime = mtime;
+	entry->size = size;
+	entry->reduce = reduce;
+	entry->drop = drop;
+	entry->bytes = sizeof(struct cache_entry) + strlen(name) + 1;
+	return entry;
+}
+
+// keeps the state of dec after decode_coefficients
+struct cache_entry *coefficients_entry(struct decoder *dec, char *name, long long mtime, long long size)
+{
+	struct cache_entry *entry = new_entry(name, mtime, size, -1, -1);
+	long long bytes = coefficients_size(dec);
+	entry->state = malloc(sizeof(struct decoder));
+	memcpy(entry->state, dec, sizeof(struct decoder));
+	entry->coeffs = malloc(bytes);
+	memcpy(entry->coeffs, dec->buffer, bytes);
+	entry->bytes += sizeof(struct decoder) + bytes;
+	return entry;
+}
+
+// keeps a copy of the samples of a reconstructed image
+struct cache_entry *rendition_entry(struct image *image, char *name, long long mtime, long long size, int reduce, int drop)
+{
+	struct cache_entry *entry = new_entry(name, mtime, size, reduce, drop);
+	long long bytes = planar_image_bytes(image);
+	entry->image = *image;
+	entry->image.planes = malloc(bytes);
+	memcpy(entry->image.planes, image->planes, bytes);
+	entry->bytes += bytes;
+	return entry;
+}
@@ -10,72 +10,83 @@ Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 
 #pragma once
 
-void cdf97(float *out, float *in, int N, int SO, int SI)
-{
-	float	a = -1.586134342f,
-		b = -0.05298011854f,
-		c = 0.8829110762f,
-		d = 0.4435068522f,
-		e = 1.149604398f;
-
-	int M = N&~1, K = N+(N&1);
-	for (int i = 1; i < N-1; i += 2)
-		in[i*SI] += a * (in[(i-1)*SI] + in[(i+1)*SI]);
-	if (!(N&1))
-		in[(N-1)*SI] += a * (2.f * in[(N-2)*SI]);
-
-	in[0] += b * (2.f * in[SI]);
-	for (int i = 2; i < M; i += 2)
-		in[i*SI] += b * (in[(i-1)*SI] + in[(i+1)*SI]);
+#include "dwt.h"
 
-	for (int i = 1; i < N-1; i += 2)
-		in[i*SI] += c * (in[(i-1)*SI] + in[(i+1)*SI]);
-	if (!(N&1))
-		in[(N-1)*SI] += c * (2.f * in[(N-2)*SI]);
-
-	in[0] += d * (2.f * in[SI]);
-	for (int i = 2; i < M; i += 2)
-		in[i*SI] += d * (in[(i-1)*SI] + in[(i+1)*SI]);
-
-	for (int i = 0; i < M; i += 2) {
-		out[(i+0)/2*SO] = in[(i+0)*SI] * e;
-		out[(i+K)/2*SO] = in[(i+1)*SI] / e;
-	}
-	if (N&1)
-		out[(N-1)/2*SO] = in[(N-1)*SI] * e;
+#define CDF97_FORWARD(L, SO, SI) { \
+	float	a = -1.586134342f, \
+		b = -0.05298011854f, \
+		c = 0.8829110762f, \
+		d = 0.4435068522f, \
+		e = 1.149604398f; \
+ \
+	int M = N&~1, K = N+(N&1); \
+	for (int i = 1; i < N-1; i += 2) \
+		DWT_LANES(L) in[i*SI+l] += a * (in[(i-1)*SI+l] + in[(i+1)*SI+l]); \
+	if (!(N&1)) \
+		DWT_LANES(L) in[(N-1)*SI+l] += a * (2.f * in[(N-2)*SI+l]); \
+ \
+	if (N > 1) \
+		DWT_LANES(L) in[l] += b * (2.f * in[SI+l]); \
+	for (int i = 2; i < M; i += 2) \
+		DWT_LANES(L) in[i*SI+l] += b * (in[(i-1)*SI+l] + in[(i+1)*SI+l]); \
+ \
+	for (int i = 1; i < N-1; i += 2) \
+		DWT_LANES(L) in[i*SI+l] += c * (in[(i-1)*SI+l] + in[(i+1)*SI+l]); \
+	if (!(N&1)) \
+		DWT_LANES(L) in[(N-1)*SI+l] += c * (2.f * in[(N-2)*SI+l]); \
+ \
+	if (N > 1) \
+		DWT_LANES(L) in[l] += d * (2.f * in[SI+l]); \
+	for (int i = 2; i < M; i += 2) \
+		DWT_LANES(L) in[i*SI+l] += d * (in[(i-1)*SI+l] + in[(i+1)*SI+l]); \
+ \
+	for (int i = 0; i < M; i += 2) { \
+		DWT_LANES(L) out[(i+0)/2*SO+l] = in[(i+0)*SI+l] * e; \
+		DWT_LANES(L) out[(i+K)/2*SO+l] = in[(i+1)*SI+l] / e; \
+	} \
+	if (N&1) \
+		DWT_LANES(L) out[(N-1)/2*SO+l] = in[(N-1)*SI+l] * e; \
 }
 
-void icdf97(float *out, float *in, int N, int SO, int SI)
-{
-	float	a = -1.586134342f,
-		b = -0.05298011854f,
-		c = 0.8829110762f,
-		d = 0.4435068522f,
-		e = 1.149604398f;
-
-	int M = N&~1, K = N+(N&1);
-	for (int i = 0; i < M; i += 2) {
-		out[(i+0)*SO] = in[(i+0)/2*SI] / e;
-		out[(i+1)*SO] = in[(i+K)/2*SI] * e;
-	}
-	if (N&1)
-		out[(N-1)*SO] = in[(N-1)/2*SI] / e;
-	out[0] -= d * (2.f * out[SO]);
-	for (int i = 2; i < M; i += 2)
-		out[i*SO] -= d * (out[(i-1)*SO] + out[(i+1)*SO]);
-
-	for (int i = 1; i < N-1; i += 2)
-		out[i*SO] -= c * (out[(i-1)*SO] + out[(i+1)*SO]);
-	if (!(N&1))
-		out[(N-1)*SO] -= c * (2.f * out[(N-2)*SO]);
+#define CDF97_INVERSE(L, SO, SI) { \
+	float	a = -1.586134342f, \
+		b = -0.05298011854f, \
+		c = 0.8829110762f, \
+		d = 0.4435068522f, \
+		e = 1.149604398f; \
+ \
+	int M = N&~1, K = N+(N&1); \
+	for (int i = 0; i < M; i += 2) { \
+		DWT_LANES(L) out[(i+0)*SO+l] = in[(i+0)/2*SI+l] / e; \
+		DWT_LANES(L) out[(i+1)*SO+l] = in[(i+K)/2*SI+l] * e; \
+	} \
+	if (N&1) \
+		DWT_LANES(L) out[(N-1)*SO+l] = in[(N-1)/2*SI+l] / e; \
+	if (N > 1) \
+		DWT_LANES(L) out[l] -= d * (2.f * out[SO+l]); \
+	for (int i = 2; i < M; i += 2) \
+		DWT_LANES(L) out[i*SO+l] -= d * (out[(i-1)*SO+l] + out[(i+1)*SO+l]); \
+ \
+	for (int i = 1; i < N-1; i += 2) \
+		DWT_LANES(L) out[i*SO+l] -= c * (out[(i-1)*SO+l] + out[(i+1)*SO+l]); \
+	if (!(N&1)) \
+		DWT_LANES(L) out[(N-1)*SO+l] -= c * (2.f * out[(N-2)*SO+l]); \
+ \
+	if (N > 1) \
+		DWT_LANES(L) out[l] -= b * (2.f * out[SO+l]); \
+	for (int i = 2; i < M; i += 2) \
+		DWT_LANES(L) out[i*SO+l] -= b * (out[(i-1)*SO+l] + out[(i+1)*SO+l]); \
+ \
+	for (int i = 1; i < N-1; i += 2) \
+		DWT_LANES(L) out[i*SO+l] -= a * (out[(i-1)*SO+l] + out[(i+1)*SO+l]); \
+	if (!(N&1)) \
+		DWT_LANES(L) out[(N-1)*SO+l] -= a * (2.f * out[(N-2)*SO+l]); \
+}
 
-	out[0] -= b * (2.f * out[SO]);
-	for (int i = 2; i < M; i += 2)
-		out[i*SO] -= b * (out[(i-1)*SO] + out[(i+1)*SO]);
+void cdf97(float *out, float *in, int N, int SO, int SI)
+CDF97_FORWARD(1, SO, SI)
 
-	for (int i = 1; i < N-1; i += 2)
-		out[i*SO] -= a * (out[(i-1)*SO] + out[(i+1)*SO]);
-	if (!(N&1))
-		out[(N-1)*SO] -= a * (2.f * out[(N-2)*SO]);
-}
+void icdf97(float *out, float *in, int N, int SO, int SI)
+CDF97_INVERSE(1, SO, SI)
 
+DWT_INSTANCES(float, cdf97, icdf97, CDF97_FORWARD, CDF97_INVERSE)
@@ -0,0 +1,51 @@
+/*
+Storage of quantized coefficients
+
+Coefficients are kept as int with the sign, significance and refinement
+flags in the top three bits or, when the planes and the root image fit
+into 15 bits, compactly as short with the sign of the detail coefficients
+in the top bit. The coding state of a compact coefficient follows from
+its magnitude bits above the current plane, as the planes of a subband
+are always coded from the top down.
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+int compact_storage(int planes, int root_bits)
+{
+	return planes <= 15 && root_bits <= 15;
+}
+
+int coefficient_size(int compact)
+{
+	return compact ? sizeof(short) : sizeof(int);
+}
+
+void *coefficient_address(void *base, int compact, long long index)
+{
+	return (char *)base + index * coefficient_size(compact);
+}
+
+int coefficient_value(void *buf, int compact, long long i)
+{
+	return compact ? ((short *)buf)[i] : ((int *)buf)[i];
+}
+
+int coefficient_magnitude(void *buf, int compact, long long i)
+{
+	int mix_mask = 7 << (sizeof(int) * 8 - 3);
+	if (compact)
+		return ((unsigned short *)buf)[i] & 32767;
+	return ((int *)buf)[i] & ~mix_mask;
+}
+
+// value of a detail coefficient still in sign and magnitude form
+int coefficient_signed(void *buf, int compact, long long i)
+{
+	int mag = coefficient_magnitude(buf, compact, i);
+	if (compact)
+		return ((unsigned short *)buf)[i] >> 15 ? -mag : mag;
+	return ((unsigned *)buf)[i] >> 31 ? -mag : mag;
+}
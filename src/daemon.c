@@ -0,0 +1,231 @@
+/*
+Local decode daemon serving renditions from a cache of decoded streams
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "decoder.h"
+#include "picture.h"
+#include "cache.h"
+#include "file.h"
+
+/*
+A request is a single connection carrying the input and output file
+names and then the reduce and drop counts, each on a line of its own.
+The reply is a single line, starting with "ok" or "error".
+
+The daemon reads and writes whatever files a request names, with its own
+privileges, so only its owner may connect: the socket is created with
+mode 0600, and the daemon should run as the user whose files it serves.
+*/
+#define REQUEST_MAX 8192
+
+// seconds a client may take to send its request
+#define REQUEST_TIMEOUT 5
+
+int open_socket(char *path, struct sockaddr_un *addr)
+{
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "socket path \"%s\" is too long.\n", path);
+		return -1;
+	}
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		fprintf(stderr, "could not create socket.\n");
+	return fd;
+}
+
+int receive_all(int fd, char *buf, int max)
+{
+	int num = 0;
+	for (int cnt; num < max && (cnt = read(fd, buf + num, max - num)) > 0;)
+		num += cnt;
+	return num;
+}
+
+// reads until the given number of lines arrived, the peer stops sending or the receive timeout passes
+int receive_lines(int fd, char *buf, int max, int lines)
+{
+	int num = 0;
+	for (int cnt; lines > 0 && num < max && (cnt = read(fd, buf + num, max - num)) > 0; num += cnt)
+		for (int i = num; i < num + cnt; ++i)
+			lines -= buf[i] == '\n';
+	return num;
+}
+
+int send_all(int fd, char *buf, int num)
+{
+	for (int cnt; num > 0; buf += cnt, num -= cnt)
+		if ((cnt = write(fd, buf, num)) <= 0)
+			return 0;
+	return 1;
+}
+
+// returns where the rendition came from or 0 on failure
+char *serve(struct cache *cache, struct decoder *dec, char *input, char *output, int reduce, int drop)
+{
+	struct stat st;
+	if (stat(input, &st)) {
+		fprintf(stderr, "could not stat \"%s\" file.\n", input);
+		return 0;
+	}
+	long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, size = st.st_size;
+	struct cache_entry *entry = find_entry(cache, input, mtime, size, reduce, drop);
+	if (entry) {
+		struct image image = entry->image;
+		image.name = output;
+		return write_image(&image) ? "rendition" : 0;
+	}
+	char *source = "coefficients";
+	entry = find_entry(cache, input, mtime, size, -1, -1);
+	if (!entry) {
+		unsigned char *data = read_file(input, &size);
+		if (!data)
+			return 0;
+		int err = decode_coefficients(dec, data, size);
+		free(data);
+		if (err) {
+			fprintf(stderr, "could not decode \"%s\" file.\n", input);
+			return 0;
+		}
+		entry = coefficients_entry(dec, input, mtime, st.st_size);
+		insert_entry(cache, entry);
+		source = "stream";
+	}
+	if (!resume_decoder(dec, entry->state, entry->coeffs))
+		return 0;
+	drop_planes(dec, drop);
+	struct image *image = reconstruct_reduced(dec, reduce);
+	if (!image) {
+		fprintf(stderr, "can not reduce \"%s\" file %d times.\n", input, reduce);
+		return 0;
+	}
+	insert_entry(cache, rendition_entry(image, input, mtime, st.st_size, reduce, drop));
+	image->name = output;
+	return write_image(image) ? source : 0;
+}
+
+int daemon_main(char *path, long long limit)
+{
+	struct sockaddr_un addr;
+	int fd = open_socket(path, &addr);
+	if (fd < 0)
+		return 1;
+	unlink(path);
+	mode_t mask = umask(0177);
+	int err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (err || chmod(path, 0600) || listen(fd, 16)) {
+		fprintf(stderr, "could not listen on \"%s\" socket.\n", path);
+		close(fd);
+		return 1;
+	}
+	struct decoder *dec = new_decoder(0, 0, 0);
+	if (!dec) {
+		close(fd);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	struct cache *cache = new_cache(limit);
+	char *request = malloc(REQUEST_MAX + 1);
+	struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+	while (1) {
+		int client = accept(fd, 0, 0);
+		if (client < 0)
+			continue;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		int num = receive_lines(client, request, REQUEST_MAX, 3);
+		request[num] = 0;
+		char *input = request, *output = strchr(input, '\n'), *counts = 0;
+		if (output) {
+			*output++ = 0;
+			if ((counts = strchr(output, '\n')))
+				*counts++ = 0;
+		}
+		int reduce, drop;
+		char *source = 0;
+		if (counts && sscanf(counts, "%d %d", &reduce, &drop) == 2 && drop >= 0)
+			source = serve(cache, dec, input, output, reduce, drop);
+		else
+			fprintf(stderr, "malformed request.\n");
+		char reply[128];
+		if (source)
+			snprintf(reply, sizeof(reply), "ok from %s, cache holds %lld bytes\n", source, cache->bytes);
+		else
+			snprintf(reply, sizeof(reply), "error\n");
+		send_all(client, reply, strlen(reply));
+		close(client);
+	}
+	free(request);
+	delete_decoder(dec);
+	delete_cache(cache);
+	close(fd);
+	return 0;
+}
+
+// the daemon may run elsewhere, so relative names are resolved here
+char *absolute_name(char *name)
+{
+	if (name[0] == '/')
+		return strdup(name);
+	char *cwd = getcwd(0, 0);
+	if (!cwd)
+		return strdup(name);
+	char *abs = malloc(strlen(cwd) + strlen(name) + 2);
+	sprintf(abs, "%s/%s", cwd, name);
+	free(cwd);
+	return abs;
+}
+
+int client_main(char *path, char *input, char *output, int reduce, int drop)
+{
+	struct sockaddr_un addr;
+	int fd = open_socket(path, &addr);
+	if (fd < 0)
+		return 1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "could not connect to \"%s\" socket.\n", path);
+		close(fd);
+		return 1;
+	}
+	char *abs_input = absolute_name(input), *abs_output = absolute_name(output);
+	char *request = malloc(strlen(abs_input) + strlen(abs_output) + 32);
+	sprintf(request, "%s\n%s\n%d %d\n", abs_input, abs_output, reduce, drop);
+	free(abs_input);
+	free(abs_output);
+	int ok = send_all(fd, request, strlen(request)) && !shutdown(fd, SHUT_WR);
+	free(request);
+	char reply[128];
+	int num = ok ? receive_all(fd, reply, sizeof(reply) - 1) : 0;
+	close(fd);
+	reply[num] = 0;
+	if (!num) {
+		fprintf(stderr, "no reply from \"%s\" socket.\n", path);
+		return 1;
+	}
+	fputs(reply, strncmp(reply, "ok", 2) ? stderr : stdout);
+	return !!strncmp(reply, "ok", 2);
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 3 || argc == 4) && !strcmp(argv[1], "serve"))
+		return daemon_main(argv[2], (argc == 4 ? atoll(argv[3]) : 1024) << 20);
+	if (argc >= 5 && argc <= 7 && !strcmp(argv[1], "get"))
+		return client_main(argv[2], argv[3], argv[4], argc >= 6 ? atoi(argv[5]) : 0, argc == 7 ? atoi(argv[6]) : 0);
+	fprintf(stderr, "usage: %s serve SOCKET [MEGABYTES]\n", argv[0]);
+	fprintf(stderr, "       %s get SOCKET input.dwt output.ppm|output.y4m [REDUCE] [DROP]\n", argv[0]);
+	return 1;
+}
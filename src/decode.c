@@ -4,227 +4,87 @@ Decoder for lossy and lossless image compression based on the discrete wavelet t
 Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 */
 
-#include "hilbert.h"
-#include "haar.h"
-#include "cdf97.h"
-#include "rint_haar.h"
-#include "utils.h"
-#include "dwt.h"
-#include "ppm.h"
-#include "rle.h"
-#include "vli.h"
-#include "bits.h"
+#include <string.h>
+#include "decoder.h"
+#include "sequence.h"
+#include "picture.h"
+#include "file.h"
+#include "batch.h"
 
-void transformation(float *output, float *input, int lmin, int width, int height, int wavelet)
+void *decode_init(void)
 {
-	void (*funcs[3])(float *, float *, int, int, int) = { ihaar, icdf97, rint_ihaar };
-	idwt2d(funcs[wavelet], output, input, lmin, width, height, 1, 1, width);
+	return new_decoder(0, 0, 0);
 }
 
-void quantization(float *output, int *input, int *missing, int *widths, int *heights, int *lengths, int levels, int wavelet)
+void decode_done(void *ctx)
 {
-	int width = widths[levels];
-	for (int y = 0; y < heights[0]; ++y) {
-		for (int x = 0; x < widths[0]; ++x) {
-			float v = *input++;
-			output[width*y+x] = v;
-		}
-	}
-	for (int l = 0; l < levels; ++l) {
-		for (int i = 0; i < lengths[l+1] * lengths[l+1]; ++i) {
-			struct position pos = hilbert(lengths[l+1], i);
-			if ((pos.x >= widths[l] || pos.y >= heights[l]) &&
-			pos.x < widths[l+1] && pos.y < heights[l+1]) {
-				float v = *input++;
-				float bias = 0.375f;
-				bias *= 1 << missing[l];
-				if (wavelet != 2 || missing[l]) {
-					if (v < 0.f)
-						v -= bias;
-					else if (v > 0.f)
-						v += bias;
-				}
-				output[width*pos.y+pos.x] = v;
-			}
-		}
-	}
-}
-
-void copy(float *output, float *input, int width, int height, int stride)
-{
-	for (int i = 0; i < width * height; ++i)
-		output[i*stride] = input[i];
+	delete_decoder(ctx);
 }
 
-int decode(struct rle_reader *rle, int *val, int num, int plane)
+long long decode_job(void *ctx, int argc, char **argv)
 {
-	int int_bits = sizeof(int) * 8;
-	int sgn_pos = int_bits - 1;
-	int sig_pos = int_bits - 2;
-	int ref_pos = int_bits - 3;
-	int sig_mask = 1 << sig_pos;
-	int ref_mask = 1 << ref_pos;
-	for (int i = 0; i < num; ++i) {
-		if (!(val[i] & ref_mask)) {
-			int bit = get_rle(rle);
-			if (bit < 0)
-				return bit;
-			val[i] |= bit << plane;
-			if (bit) {
-				int sgn = rle_get_bit(rle);
-				if (sgn < 0)
-					return sgn;
-				val[i] |= (sgn << sgn_pos) | sig_mask;
-			}
-		}
+	struct decoder *dec = ctx;
+	if (argc < 2) {
+		fprintf(stderr, "missing output file for \"%s\".\n", argv[0]);
+		return -1;
 	}
-	for (int i = 0; i < num; ++i) {
-		if (val[i] & ref_mask) {
-			int bit = rle_get_bit(rle);
-			if (bit < 0)
-				return bit;
-			val[i] |= bit << plane;
-		} else if (val[i] & sig_mask) {
-			val[i] ^= sig_mask | ref_mask;
-		}
+	long long size;
+	unsigned char *data = read_file(argv[0], &size);
+	if (!data)
+		return -1;
+	if (size >= 4 && !memcmp(data, "DWTS", 4)) {
+		long long pixels = decode_sequence(dec, data, size, argv[1]);
+		free(data);
+		return pixels;
 	}
-	return 0;
-}
-
-void process(int *val, int num)
-{
-	int int_bits = sizeof(int) * 8;
-	int sgn_pos = int_bits - 1;
-	int sig_pos = int_bits - 2;
-	int ref_pos = int_bits - 3;
-	int sgn_mask = 1 << sgn_pos;
-	int sig_mask = 1 << sig_pos;
-	int ref_mask = 1 << ref_pos;
-	for (int i = 0; i < num; ++i) {
-		val[i] &= ~(sig_mask|ref_mask);
-		if (val[i] & sgn_mask)
-			val[i] = -(val[i]^sgn_mask);
+	struct image *image = decode_image(dec, data, size);
+	free(data);
+	if (!image) {
+		fprintf(stderr, "could not decode \"%s\" file.\n", argv[0]);
+		return -1;
 	}
-}
-
-int decode_root(struct vli_reader *vli, int *val, int num)
-{
-	int cnt = get_vli(vli);
-	if (cnt < 0)
-		return cnt;
-	for (int i = 0; cnt && i < num; ++i) {
-		int ret = vli_read_bits(vli, val+i, cnt);
-		if (ret)
-			return ret;
-		if (val[i] && (ret = vli_get_bit(vli)))
-			val[i] = -val[i];
-		if (ret < 0)
-			return ret;
-	}
-	return 0;
+	image->name = argv[1];
+	if (!write_image(image))
+		return -1;
+	return image->total;
 }
 
 int main(int argc, char **argv)
 {
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s input.dwt output.ppm\n", argv[0]);
-		return 1;
+	if (argc >= 3 && !strcmp(argv[1], "--batch")) {
+		int threads = 0;
+		if (argc == 5 && !strcmp(argv[3], "-j"))
+			threads = atoi(argv[4]);
+		else if (argc != 3)
+			goto usage;
+		return run_batch(argv[2], threads, decode_init, decode_job, decode_done);
 	}
-	struct bits_reader *bits = bits_reader(argv[1]);
-	if (!bits)
-		return 1;
-	int coding = get_bit(bits);
-	if (coding != 0)
-		return 1;
-	struct vli_reader *vli = vli_reader(bits);
-	int wavelet = get_vli(vli);
-	int width = get_vli(vli);
-	int height = get_vli(vli);
-	int lmin = get_vli(vli);
-	if ((wavelet|width|height|lmin) < 0)
-		return 1;
-	int lengths[16], widths[16], heights[16];
-	int levels = compute_lengths(lengths, widths, heights, width, height, lmin);
-	int pixels_root = widths[0] * heights[0];
-	int pixels = width * height;
-	int *buffer = malloc(sizeof(int) * 3 * pixels);
-	for (int i = 0; i < 3 * pixels; ++i)
-		buffer[i] = 0;
-	for (int chan = 0; chan < 3; ++chan)
-		if (decode_root(vli, buffer+chan*pixels, pixels_root))
-			return 1;
-	int planes[3];
-	for (int chan = 0; chan < 3; ++chan)
-		if ((planes[chan] = get_vli(vli)) < 0)
-			return 1;
-	int planes_max = 0;
-	for (int chan = 0; chan < 3; ++chan)
-		if (planes_max < planes[chan])
-			planes_max = planes[chan];
-	int maximum = levels > planes_max ? levels : planes_max;
-	int layers_max = 2 * maximum - 1;
-	int missing[3*levels];
-	for (int chan = 0; chan < 3; ++chan)
-		for (int i = 0; i < levels; ++i)
-			missing[chan*levels+i] = planes[chan];
-	struct rle_reader *rle = rle_reader(vli);
-	if (planes_max == planes[0]) {
-		int num = widths[1] * heights[1] - pixels_root;
-		if (decode(rle, buffer+pixels_root, num, planes[0]-1))
-			goto end;
-		--missing[0];
-	}
-	for (int layers = 0; layers < layers_max; ++layers) {
-		for (int l = 0, *buf = buffer+pixels_root,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l];
-		l < levels && l <= layers+1; buf += num, ++l,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l]) {
-			for (int chan = 0; chan < 1; ++chan) {
-				int plane = planes_max-1 - (layers+1-l);
-				if (plane < 0 || plane >= planes[chan])
-					continue;
-				if (decode(rle, buf+chan*pixels, num, plane))
-					goto end;
-				--missing[chan*levels+l];
-			}
-		}
-		for (int l = 0, *buf = buffer+pixels_root,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l];
-		l < levels && l <= layers; buf += num, ++l,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l]) {
-			for (int chan = 1; chan < 3; ++chan) {
-				int plane = planes_max-1 - (layers-l);
-				if (plane < 0 || plane >= planes[chan])
-					continue;
-				if (decode(rle, buf+chan*pixels, num, plane))
-					goto end;
-				--missing[chan*levels+l];
-			}
-		}
+	int max_layers = -1;
+	double budget = 0;
+	while (argc >= 3 && argv[1][0] == '-' && argv[1][1] == '-') {
+		if (!strcmp(argv[1], "--out-of-core"))
+			out_of_core(argv[2]);
+		else if (!strcmp(argv[1], "--deadline-ms"))
+			budget = atof(argv[2]) / 1000;
+		else if (!strcmp(argv[1], "--max-layers"))
+			max_layers = atoi(argv[2]);
+		else
+			goto usage;
+		argv += 2;
+		argc -= 2;
 	}
-end:
-	delete_rle_reader(rle);
-	delete_vli_reader(vli);
-	close_reader(bits);
-	for (int chan = 0; chan < 3; ++chan)
-		process(buffer+chan*pixels+pixels_root, pixels-pixels_root);
-	struct image *image = new_image(argv[2], width, height);
-	float *input = malloc(sizeof(float) * pixels);
-	float *output = malloc(sizeof(float) * pixels);
-	for (int chan = 0; chan < 3; ++chan) {
-		quantization(input, buffer+chan*pixels, missing+chan*levels, widths, heights, lengths, levels, wavelet);
-		transformation(output, input, lmin, width, height, wavelet);
-		copy(image->buffer+chan, output, width, height, 3);
-	}
-	free(buffer);
-	free(input);
-	free(output);
-	for (int i = 0; i < width * height; ++i)
-		image->buffer[3*i] += 128.f;
-	srgb_from_rct(image);
-	if (!write_ppm(image))
+	if (argc != 3)
+		goto usage;
+	struct decoder *dec = new_decoder(0, 0, 0);
+	if (!dec)
 		return 1;
-	delete_image(image);
-	return 0;
+	dec->max_layers = max_layers;
+	dec->budget = budget;
+	long long pixels = decode_job(dec, argc - 1, argv + 1);
+	delete_decoder(dec);
+	return pixels < 0;
+usage:
+	fprintf(stderr, "usage: %s [--out-of-core DIR] [--deadline-ms MS] [--max-layers N] input.dwt output.ppm|output.y4m\n", argv[0]);
+	fprintf(stderr, "       %s --batch list.txt [-j THREADS]\n", argv[0]);
+	return 1;
 }
-
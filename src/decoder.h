@@ -0,0 +1,729 @@
+/*
+Decoder for lossy and lossless image compression based on the discrete wavelet transformation
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hilbert.h"
+#include "haar.h"
+#include "cdf97.h"
+#include "rint_haar.h"
+#include "utils.h"
+#include "dwt.h"
+#include "image.h"
+#include "rle.h"
+#include "vli.h"
+#include "bits.h"
+#include "coefficients.h"
+#include "mapping.h"
+
+struct decoder {
+	void *arena;
+	long long arena_size, max_pixels;
+	int max_depth, max_channels;
+	float *input, *output;
+	int *buffer;
+	void *coeffs[MAX_CHANNELS];
+	int compact[MAX_CHANNELS];
+	void *samples;
+	struct image image;
+	struct bits_reader *bits;
+	struct vli_reader *vli;
+	struct rle_reader *rle;
+	int width, height, maxval, sampling, wavelet, lmin, shared;
+	int channels, decorrelation;
+	struct video video;
+	int lengths[MAX_CHANNELS][32], widths[MAX_CHANNELS][32], heights[MAX_CHANNELS][32];
+	int levels[MAX_CHANNELS], levels_x[MAX_CHANNELS], levels_y[MAX_CHANNELS], planes[MAX_CHANNELS];
+	long long pixels[MAX_CHANNELS], offsets[MAX_CHANNELS+1];
+	int missing[MAX_CHANNELS][32], steps[MAX_CHANNELS][32];
+	int order[MAX_CHANNELS*32*32], passes, optimize, substreams;
+	int max_layers;
+	double budget, deadline;
+};
+
+double decoder_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// stops decoding at a layer boundary after max_layers or once the time budget is used up
+int enough_layers(struct decoder *dec, int layers)
+{
+	if (dec->max_layers >= 0 && layers >= dec->max_layers)
+		return 1;
+	return dec->budget > 0 && decoder_seconds() >= dec->deadline;
+}
+
+// returns the buffer holding the samples, the other one is free for use
+float *inverse_transformation(float *output, float *input, int levels_x, int levels_y, int width, int height, int wavelet)
+{
+	switch (wavelet) {
+	case 0:
+		idwt2d_haar(output, input, levels_x, levels_y, width, height, width);
+		break;
+	case 1:
+		idwt2d_cdf97(output, input, levels_x, levels_y, width, height, width);
+		break;
+	default:
+		idwt2d_rint_haar(output, input, levels_x, levels_y, width, height, width);
+	}
+	return output;
+}
+
+void inverse_quantization(float *output, void *input, int compact, int *missing, int *widths, int *heights, int *lengths, int *steps, int levels, int wavelet)
+{
+	int width = widths[levels];
+	long long index = 0;
+	for (int y = 0; y < heights[0]; ++y) {
+		for (int x = 0; x < widths[0]; ++x) {
+			float v = coefficient_value(input, compact, index++);
+			output[(long long)width*y+x] = v;
+		}
+	}
+	struct position table[256], block[256];
+	for (int l = 0; l < levels; ++l) {
+		float factor = steps[l] / 16.f;
+		float bias = 0.375f;
+		bias *= 1 << missing[l];
+		if (wavelet == 2 && !missing[l] && steps[l] == 16)
+			bias = 0.f;
+		int n = lengths[l+1], k = hilbert_table(table, n);
+		for (long long d = 0; d < (long long)n * n; d += 1 << 2 * k) {
+			if (!hilbert_block(block, table, n, d, k, widths[l+1], heights[l+1]))
+				continue;
+			for (int i = 0; i < 1 << 2 * k; ++i) {
+				struct position pos = block[i];
+				if ((pos.x >= widths[l] || pos.y >= heights[l]) &&
+				pos.x < widths[l+1] && pos.y < heights[l+1]) {
+					float v = coefficient_signed(input, compact, index++);
+					if (v < 0.f)
+						v -= bias;
+					else if (v > 0.f)
+						v += bias;
+					output[(long long)width*pos.y+pos.x] = factor * v;
+				}
+			}
+		}
+	}
+}
+
+void inverse_copy(int *output, float *input, int width, int height)
+{
+	for (long long i = 0; i < (long long)width * height; ++i)
+		output[i] = nearbyintf(input[i]);
+}
+
+int decode(struct rle_reader *rle, int *val, long long num, int plane)
+{
+	int int_bits = sizeof(int) * 8;
+	int sgn_pos = int_bits - 1;
+	int sig_pos = int_bits - 2;
+	int ref_pos = int_bits - 3;
+	int sig_mask = 1 << sig_pos;
+	int ref_mask = 1 << ref_pos;
+	for (long long i = 0; i < num; ++i) {
+		if (!(val[i] & ref_mask)) {
+			int bit = get_rle(rle);
+			if (bit < 0)
+				return bit;
+			val[i] |= bit << plane;
+			if (bit) {
+				int sgn = rle_get_bit(rle);
+				if (sgn < 0)
+					return sgn;
+				val[i] |= (sgn << sgn_pos) | sig_mask;
+			}
+		}
+	}
+	for (long long i = 0; i < num; ++i) {
+		if (val[i] & ref_mask) {
+			int bit = rle_get_bit(rle);
+			if (bit < 0)
+				return bit;
+			val[i] |= bit << plane;
+		} else if (val[i] & sig_mask) {
+			val[i] ^= sig_mask | ref_mask;
+		}
+	}
+	return 0;
+}
+
+int decode16(struct rle_reader *rle, unsigned short *val, long long num, int plane)
+{
+	int sgn_mask = 1 << 15;
+	int mag_mask = sgn_mask - 1;
+	for (long long i = 0; i < num; ++i) {
+		if (!((val[i] & mag_mask) >> (plane + 1))) {
+			int bit = get_rle(rle);
+			if (bit < 0)
+				return bit;
+			if (bit) {
+				int sgn = rle_get_bit(rle);
+				if (sgn < 0)
+					return sgn;
+				val[i] |= (sgn << 15) | (1 << plane);
+			}
+		}
+	}
+	for (long long i = 0; i < num; ++i) {
+		if ((val[i] & mag_mask) >> (plane + 1)) {
+			int bit = rle_get_bit(rle);
+			if (bit < 0)
+				return bit;
+			val[i] |= bit << plane;
+		}
+	}
+	return 0;
+}
+
+int decode_root(struct vli_reader *vli, void *val, int compact, long long num, int cnt)
+{
+	for (long long i = 0; cnt && i < num; ++i) {
+		int v, ret = vli_read_bits(vli, &v, cnt);
+		if (ret)
+			return ret;
+		if (v && (ret = vli_get_bit(vli)))
+			v = -v;
+		if (ret < 0)
+			return ret;
+		if (compact)
+			((short *)val)[i] = v;
+		else
+			((int *)val)[i] = v;
+	}
+	return 0;
+}
+
+int decode_pass(struct decoder *dec, struct rle_reader *rle, void *buf, long long num, int chan, int plane)
+{
+	if (dec->compact[chan])
+		return decode16(rle, buf, num, plane);
+	return decode(rle, buf, num, plane);
+}
+
+// returns 0 and leaves the decoder without arena if it could not be allocated
+int reserve_decoder(struct decoder *dec, long long pixels, int channels, int depth)
+{
+	if (pixels <= dec->max_pixels && channels <= dec->max_channels && depth <= dec->max_depth)
+		return 1;
+	if (dec->max_pixels > pixels)
+		pixels = dec->max_pixels;
+	if (dec->max_channels > channels)
+		channels = dec->max_channels;
+	if (dec->max_depth > depth)
+		depth = dec->max_depth;
+	long long floats = align_size(sizeof(float) * pixels);
+	long long ints = align_size(sizeof(int) * channels * pixels);
+	long long samples = channels * pixels * (depth > 8 ? sizeof(unsigned short) : sizeof(unsigned char));
+	free_large(dec->arena, dec->arena_size);
+	dec->arena_size = 2 * floats + ints + samples;
+	char *arena = dec->arena = alloc_large(dec->arena_size);
+	if (!arena) {
+		dec->arena_size = 0;
+		dec->max_pixels = 0;
+		dec->max_channels = 0;
+		dec->max_depth = 0;
+		return 0;
+	}
+	dec->input = (float *)arena;
+	dec->output = (float *)(arena + floats);
+	dec->buffer = (int *)(arena + 2 * floats);
+	dec->samples = arena + 2 * floats + ints;
+	dec->max_pixels = pixels;
+	dec->max_channels = channels;
+	dec->max_depth = depth;
+	return 1;
+}
+
+void delete_decoder(struct decoder *dec)
+{
+	delete_rle_reader(dec->rle);
+	delete_vli_reader(dec->vli);
+	delete_bits_reader(dec->bits);
+	free_large(dec->arena, dec->arena_size);
+	free(dec);
+}
+
+// returns 0 if the arena for width * height samples could not be allocated
+struct decoder *new_decoder(int width, int height, int maxval)
+{
+	struct decoder *dec = malloc(sizeof(struct decoder));
+	dec->arena = 0;
+	dec->arena_size = 0;
+	dec->max_pixels = 0;
+	dec->max_channels = 0;
+	dec->max_depth = 0;
+	dec->bits = bits_reader(0, 0);
+	dec->vli = vli_reader(dec->bits);
+	dec->rle = rle_reader(dec->vli);
+	dec->shared = 0;
+	dec->max_layers = -1;
+	dec->budget = 0;
+	int depth = 1;
+	while (maxval >> depth)
+		depth++;
+	if (!reserve_decoder(dec, (long long)width * height, 3, depth)) {
+		delete_decoder(dec);
+		return 0;
+	}
+	return dec;
+}
+
+// number of layers in the fixed schedule
+int decoder_layers(struct decoder *dec, int *planes_max)
+{
+	int levels_max = 0;
+	*planes_max = 0;
+	for (int chan = 0; chan < dec->channels; ++chan) {
+		if (*planes_max < dec->planes[chan])
+			*planes_max = dec->planes[chan];
+		if (levels_max < dec->levels[chan])
+			levels_max = dec->levels[chan];
+	}
+	int maximum = levels_max > *planes_max ? levels_max : *planes_max;
+	return 2 * maximum - 1;
+}
+
+// passes of the channels first to last-1 in the layer, where layer -1 is the first pass of the luma alone
+int decode_layer(struct decoder *dec, struct rle_reader *rle, int layers, int planes_max, int first, int last)
+{
+	int (*widths)[32] = dec->widths, (*heights)[32] = dec->heights;
+	int *levels = dec->levels, *planes = dec->planes;
+	int (*missing)[32] = dec->missing;
+	for (int l = 0; l <= layers+1; ++l) {
+		for (int chan = first; chan < last && chan < 1; ++chan) {
+			int plane = planes_max-1 - (layers+1-l);
+			if (l >= levels[chan] || plane < 0 || plane >= planes[chan])
+				continue;
+			void *buf = coefficient_address(dec->coeffs[chan], dec->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			if (decode_pass(dec, rle, buf, num, chan, plane))
+				return 1;
+			--missing[chan][l];
+		}
+	}
+	for (int l = 0; l <= layers; ++l) {
+		for (int chan = first > 1 ? first : 1; chan < last; ++chan) {
+			int plane = planes_max-1 - (layers-l);
+			if (l >= levels[chan] || plane < 0 || plane >= planes[chan])
+				continue;
+			void *buf = coefficient_address(dec->coeffs[chan], dec->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			if (decode_pass(dec, rle, buf, num, chan, plane))
+				return 1;
+			--missing[chan][l];
+		}
+	}
+	return 0;
+}
+
+void decode_fixed_layers(struct decoder *dec)
+{
+	int planes_max, layers_max = decoder_layers(dec, &planes_max);
+	if (decode_layer(dec, dec->rle, -1, planes_max, 0, dec->channels))
+		return;
+	for (int layers = 0; layers < layers_max; ++layers)
+		if (decode_layer(dec, dec->rle, layers, planes_max, 0, dec->channels) || enough_layers(dec, layers + 1))
+			return;
+}
+
+// a channel of its own, gathered from the chunks of the layers
+struct substream_reader {
+	struct decoder *dec;
+	struct bits_reader bits;
+	struct vli_reader vli;
+	struct rle_reader rle;
+	int chan;
+	pthread_t thread;
+};
+
+void *decode_substream(void *ptr)
+{
+	struct substream_reader *sub = ptr;
+	struct decoder *dec = sub->dec;
+	int planes_max, layers_max = decoder_layers(dec, &planes_max);
+	if (decode_layer(dec, &sub->rle, -1, planes_max, sub->chan, sub->chan + 1))
+		return 0;
+	for (int layers = 0; layers < layers_max; ++layers) {
+		if (decode_layer(dec, &sub->rle, layers, planes_max, sub->chan, sub->chan + 1) || enough_layers(dec, layers + 1))
+			break;
+		// skip the padding and the end of the zero run at the byte boundary after the layer
+		sub->rle.cnt = 0;
+		sub->bits.cnt = 0;
+	}
+	return 0;
+}
+
+// reads the table of chunk sizes and decodes the channels concurrently from the chunks that follow it
+int decode_substreams(struct decoder *dec, unsigned char *data, long long size)
+{
+	int planes_max, layers_max = decoder_layers(dec, &planes_max);
+	int rows = get_vli(dec->vli);
+	if (rows > layers_max)
+		return -1;
+	// the chunks follow the table, so a truncated table leaves just the roots
+	if (rows < 0)
+		return 0;
+	long long chunks[64][MAX_CHANNELS], total[MAX_CHANNELS] = { 0 };
+	for (int k = 0; k < rows; ++k)
+		for (int chan = 0; chan < dec->channels; ++chan)
+			if ((chunks[k][chan] = get_vli64(dec->vli)) < 0)
+				return 0;
+	// a truncated stream ends in the middle of the chunks
+	long long first = dec->bits->pos, pos = first;
+	for (int k = 0; k < rows; ++k) {
+		for (int chan = 0; chan < dec->channels; ++chan) {
+			if (chunks[k][chan] > size - pos)
+				chunks[k][chan] = size - pos;
+			total[chan] += chunks[k][chan];
+			pos += chunks[k][chan];
+		}
+	}
+	unsigned char *streams = malloc(pos - first + 1);
+	if (!streams)
+		return -1;
+	struct substream_reader subs[MAX_CHANNELS];
+	long long ends[MAX_CHANNELS];
+	for (int chan = 0; chan < dec->channels; ++chan) {
+		struct substream_reader *sub = subs + chan;
+		ends[chan] = chan ? ends[chan-1] + total[chan-1] : 0;
+		sub->dec = dec;
+		sub->chan = chan;
+		reset_bits_reader(&sub->bits, streams + ends[chan], total[chan]);
+		sub->vli.bits = &sub->bits;
+		reset_vli_reader(&sub->vli);
+		sub->rle.vli = &sub->vli;
+		reset_rle_reader(&sub->rle);
+	}
+	for (int k = 0; k < rows; ++k) {
+		for (int chan = 0; chan < dec->channels; ++chan) {
+			memcpy(streams + ends[chan], data + first, chunks[k][chan]);
+			ends[chan] += chunks[k][chan];
+			first += chunks[k][chan];
+		}
+	}
+	int threads[MAX_CHANNELS];
+	for (int chan = 0; chan < dec->channels; ++chan)
+		if (!(threads[chan] = !pthread_create(&subs[chan].thread, 0, decode_substream, subs + chan)))
+			decode_substream(subs + chan);
+	for (int chan = 0; chan < dec->channels; ++chan)
+		if (threads[chan])
+			pthread_join(subs[chan].thread, 0);
+	free(streams);
+	return 0;
+}
+
+void decode_optimized_layers(struct decoder *dec)
+{
+	int (*widths)[32] = dec->widths, (*heights)[32] = dec->heights;
+	int *levels = dec->levels, *planes = dec->planes;
+	int (*missing)[32] = dec->missing;
+	int chans[MAX_CHANNELS*32], ls[MAX_CHANNELS*32], groups = 0;
+	for (int chan = 0; chan < dec->channels; ++chan) {
+		if (!planes[chan])
+			continue;
+		for (int l = 0; l < levels[chan]; ++l, ++groups) {
+			chans[groups] = chan;
+			ls[groups] = l;
+		}
+	}
+	for (int i = 0; i < dec->passes; ++i) {
+		int g = dec->order[i], chan = chans[g], l = ls[g];
+		void *buf = coefficient_address(dec->coeffs[chan], dec->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+		long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+		if (decode_pass(dec, dec->rle, buf, num, chan, missing[chan][l] - 1))
+			return;
+		--missing[chan][l];
+		if (enough_layers(dec, i + 1))
+			return;
+	}
+}
+
+int decode_coefficients(struct decoder *dec, unsigned char *data, long long size)
+{
+	struct bits_reader *bits = dec->bits;
+	struct vli_reader *vli = dec->vli;
+	struct rle_reader *rle = dec->rle;
+	reset_bits_reader(bits, data, size);
+	reset_vli_reader(vli);
+	reset_rle_reader(rle);
+	dec->deadline = decoder_seconds() + dec->budget;
+	if (!dec->shared) {
+		int coding = get_bit(bits);
+		if (coding != 0)
+			return -1;
+		dec->wavelet = get_vli(vli);
+		dec->width = get_vli(vli);
+		dec->height = get_vli(vli);
+		dec->lmin = get_vli(vli);
+		dec->maxval = get_vli(vli);
+		dec->sampling = get_vli(vli);
+		dec->channels = get_vli(vli);
+		dec->decorrelation = get_vli(vli);
+	}
+	int wavelet = dec->wavelet, width = dec->width, height = dec->height;
+	int lmin = dec->lmin, maxval = dec->maxval, sampling = dec->sampling;
+	int channels = dec->channels, decorrelation = dec->decorrelation;
+	if ((wavelet|width|height|lmin|maxval|sampling|channels|decorrelation) < 0 || wavelet > 2 ||
+	!channels || channels > MAX_CHANNELS || decorrelation > 2 ||
+	((sampling || decorrelation == 1) && channels != 3) || (sampling && decorrelation))
+		return -1;
+	struct video *video = &dec->video;
+	default_video(video);
+	if (sampling) {
+		video->rate[0] = get_vli(vli);
+		video->rate[1] = get_vli(vli);
+		video->interlace = get_vli(vli);
+		video->aspect[0] = get_vli(vli);
+		video->aspect[1] = get_vli(vli);
+		video->siting = get_vli(vli);
+		if (video->rate[0] <= 0 || video->rate[1] <= 0 || video->interlace < 0 || video->interlace > 3 ||
+		(video->aspect[0]|video->aspect[1]) < 0 || video->siting < 0 || video->siting > 2)
+			return -1;
+	}
+	struct image *image = &dec->image;
+	init_planar_image(image, 0, width, height, channels, maxval, sampling);
+	if (!reserve_decoder(dec, image->total, channels, image->depth))
+		return -1;
+	image->planes = dec->samples;
+	image->video = *video;
+	int (*lengths)[32] = dec->lengths, (*widths)[32] = dec->widths, (*heights)[32] = dec->heights;
+	int *levels = dec->levels;
+	long long *pixels = dec->pixels, *offsets = dec->offsets;
+	offsets[0] = 0;
+	for (int chan = 0; chan < channels; ++chan) {
+		int w = plane_width(image, chan), h = plane_height(image, chan);
+		int lx = dec->levels_x[chan] = get_vli(vli), ly = dec->levels_y[chan] = get_vli(vli);
+		if (lx < 0 || ly < 0 || lx > 30 || ly > 30 || !(lx|ly))
+			return -1;
+		levels[chan] = compute_lengths(lengths[chan], widths[chan], heights[chan], w, h, lx, ly);
+		pixels[chan] = (long long)w * h;
+		offsets[chan+1] = offsets[chan] + pixels[chan];
+	}
+	int (*steps)[32] = dec->steps;
+	for (int chan = 0; chan < channels; ++chan)
+		for (int l = 0; l < levels[chan]; ++l)
+			if ((steps[chan][l] = get_vli(vli)) <= 0)
+				return -1;
+	int *planes = dec->planes;
+	for (int chan = 0; chan < channels; ++chan)
+		if ((planes[chan] = get_vli(vli)) < 0 || planes[chan] > 29)
+			return -1;
+	char *coeffs = (char *)dec->buffer;
+	for (int chan = 0; chan < channels; ++chan) {
+		int cnt = get_vli(vli);
+		if (cnt < 0 || cnt > 30)
+			return -1;
+		int compact = dec->compact[chan] = compact_storage(planes[chan], cnt);
+		dec->coeffs[chan] = coeffs;
+		coeffs += pixels[chan] * coefficient_size(compact);
+		memset(dec->coeffs[chan], 0, pixels[chan] * coefficient_size(compact));
+		if (decode_root(vli, dec->coeffs[chan], compact, (long long)widths[chan][0] * heights[chan][0], cnt))
+			return -1;
+	}
+	int (*missing)[32] = dec->missing;
+	for (int chan = 0; chan < channels; ++chan)
+		for (int i = 0; i < levels[chan]; ++i)
+			missing[chan][i] = planes[chan];
+	if ((dec->optimize = get_vli(vli)) < 0)
+		return -1;
+	if (dec->optimize) {
+		int groups = 0, total = 0, count[MAX_CHANNELS*32];
+		for (int chan = 0; chan < channels; ++chan) {
+			if (!planes[chan])
+				continue;
+			for (int l = 0; l < levels[chan]; ++l)
+				total += count[groups++] = planes[chan];
+		}
+		int cnt = 1 + ilog2(groups - 1);
+		for (dec->passes = 0; dec->passes < total; ++dec->passes) {
+			int group = 0;
+			if (vli_read_bits(vli, &group, cnt) || group >= groups || !count[group]--)
+				return -1;
+			dec->order[dec->passes] = group;
+		}
+		decode_optimized_layers(dec);
+	} else {
+		if ((dec->substreams = get_vli(vli)) < 0)
+			return -1;
+		if (dec->substreams)
+			return decode_substreams(dec, data, size);
+		decode_fixed_layers(dec);
+	}
+	return 0;
+}
+
+// returns the samples of the channel, left in dec->output or dec->input
+float *reconstruct_channel(struct decoder *dec, int chan)
+{
+	int (*lengths)[32] = dec->lengths, (*widths)[32] = dec->widths, (*heights)[32] = dec->heights;
+	int *levels = dec->levels;
+	int w = widths[chan][levels[chan]], h = heights[chan][levels[chan]];
+	inverse_quantization(dec->input, dec->coeffs[chan], dec->compact[chan], dec->missing[chan], widths[chan], heights[chan], lengths[chan], dec->steps[chan], levels[chan], dec->wavelet);
+	return inverse_transformation(dec->output, dec->input, dec->levels_x[chan], dec->levels_y[chan], w, h, dec->wavelet);
+}
+
+struct image *convert_image(struct decoder *dec)
+{
+	struct image *image = &dec->image;
+	long long *offsets = dec->offsets;
+	int *buffer = dec->buffer;
+	if (dec->decorrelation == 1) {
+		srgb_planes_from_rct(image, buffer, buffer+offsets[1], buffer+offsets[2]);
+		return image;
+	}
+	for (int chan = 1; dec->decorrelation == 2 && chan < dec->channels; ++chan)
+		for (long long i = 0; i < dec->pixels[chan]; ++i)
+			buffer[offsets[chan]+i] += buffer[i];
+	for (int chan = 0; chan < dec->channels; ++chan)
+		plane_from_centered(image, chan, buffer+offsets[chan]);
+	return image;
+}
+
+struct decoder_rows {
+	struct decoder *dec;
+	int chan, *scratch;
+	float scale;
+};
+
+void decoded_row(void *ctx, float *row, int j)
+{
+	struct decoder_rows *rows = ctx;
+	struct decoder *dec = rows->dec;
+	struct image *image = &dec->image;
+	int chan = rows->chan;
+	long long first = (long long)plane_width(image, chan) * j;
+	if (rows->scale != 1.f)
+		for (int i = 0; i < plane_width(image, chan); ++i)
+			row[i] *= rows->scale;
+	if (!dec->decorrelation)
+		row_from_centered(image, chan, j, row, rows->scratch);
+	else if (chan)
+		inverse_copy(dec->buffer+dec->offsets[chan]+first, row, plane_width(image, chan), 1);
+	else if (dec->decorrelation == 1)
+		srgb_row_from_rct(image, j, row, dec->buffer+dec->offsets[1]+first, dec->buffer+dec->offsets[2]+first, rows->scratch);
+	else
+		bands_row_from_differences(image, j, row, dec->buffer, dec->offsets, rows->scratch);
+}
+
+// reconstructs the image at 2^-reduce of its size from the coarser levels only
+struct image *reconstruct_reduced(struct decoder *dec, int reduce)
+{
+	int *levels = dec->levels;
+	// only the levels splitting both axes scale the image down evenly
+	for (int chan = 0; chan < dec->channels; ++chan)
+		if (reduce < 0 || reduce > dec->levels_x[chan] || reduce > dec->levels_y[chan])
+			return 0;
+	struct image *image = &dec->image;
+	init_planar_image(image, 0, dec->widths[0][levels[0]-reduce], dec->heights[0][levels[0]-reduce], dec->channels, dec->maxval, dec->sampling);
+	image->planes = dec->samples;
+	image->video = dec->video;
+	void (*funcs[3])(float *, float *, int, int, int, int, int, void (*)(void *, float *, int), void *) = { idwt2d_rows_haar, idwt2d_rows_cdf97, idwt2d_rows_rint_haar };
+	// the lowpass of the normalized wavelets gains a factor of two per level
+	float scale = dec->wavelet < 2 ? ldexpf(1.f, -reduce) : 1.f;
+	struct decoder_rows rows = { dec, 0, malloc(sizeof(int) * 3 * image->width), scale };
+	// the samples of a channel may overwrite the coefficients of the following ones
+	for (int chan = dec->channels - 1; chan >= 0; --chan) {
+		int l = levels[chan] - reduce, w = dec->widths[chan][l], h = dec->heights[chan][l];
+		int lx = dec->levels_x[chan] - reduce, ly = dec->levels_y[chan] - reduce;
+		inverse_quantization(dec->input, dec->coeffs[chan], dec->compact[chan], dec->missing[chan], dec->widths[chan], dec->heights[chan], dec->lengths[chan], dec->steps[chan], l, dec->wavelet);
+		rows.chan = chan;
+		funcs[dec->wavelet](dec->output, dec->input, lx, ly, w, h, w, decoded_row, &rows);
+	}
+	free(rows.scratch);
+	return image;
+}
+
+struct image *reconstruct_image(struct decoder *dec)
+{
+	return reconstruct_reduced(dec, 0);
+}
+
+// discards the lowest planes of the detail coefficients, as if the stream ended that many planes earlier
+void drop_planes(struct decoder *dec, int drop)
+{
+	// a partially decoded plane below the missing ones must stay
+	if (drop <= 0)
+		return;
+	for (int chan = 0; chan < dec->channels; ++chan) {
+		int compact = dec->compact[chan];
+		for (int l = 0; l < dec->levels[chan]; ++l) {
+			int missing = dec->missing[chan][l] + drop;
+			if (missing > dec->planes[chan])
+				missing = dec->planes[chan];
+			int mask = (1 << missing) - 1;
+			long long first = (long long)dec->widths[chan][l] * dec->heights[chan][l];
+			long long last = (long long)dec->widths[chan][l+1] * dec->heights[chan][l+1];
+			for (long long i = first; i < last; ++i) {
+				if (compact)
+					((unsigned short *)dec->coeffs[chan])[i] &= ~mask;
+				else
+					((int *)dec->coeffs[chan])[i] &= ~mask;
+			}
+			dec->missing[chan][l] = missing;
+		}
+	}
+}
+
+// bytes of the coefficients that decode_coefficients left in dec->buffer
+long long coefficients_size(struct decoder *dec)
+{
+	long long size = 0;
+	for (int chan = 0; chan < dec->channels; ++chan)
+		size += dec->pixels[chan] * coefficient_size(dec->compact[chan]);
+	return size;
+}
+
+// continues from a copy of a decoder taken after decode_coefficients and its coefficients saved apart, returns 0 if out of memory
+int resume_decoder(struct decoder *dec, struct decoder *state, void *coeffs)
+{
+	struct image *image = &dec->image;
+	init_planar_image(image, 0, state->width, state->height, state->channels, state->maxval, state->sampling);
+	if (!reserve_decoder(dec, image->total, state->channels, image->depth))
+		return 0;
+	image->planes = dec->samples;
+	image->video = dec->video = state->video;
+	dec->wavelet = state->wavelet;
+	dec->width = state->width;
+	dec->height = state->height;
+	dec->lmin = state->lmin;
+	dec->maxval = state->maxval;
+	dec->sampling = state->sampling;
+	dec->channels = state->channels;
+	dec->decorrelation = state->decorrelation;
+	memcpy(dec->lengths, state->lengths, sizeof(dec->lengths));
+	memcpy(dec->widths, state->widths, sizeof(dec->widths));
+	memcpy(dec->heights, state->heights, sizeof(dec->heights));
+	memcpy(dec->levels, state->levels, sizeof(dec->levels));
+	memcpy(dec->levels_x, state->levels_x, sizeof(dec->levels_x));
+	memcpy(dec->levels_y, state->levels_y, sizeof(dec->levels_y));
+	memcpy(dec->planes, state->planes, sizeof(dec->planes));
+	memcpy(dec->pixels, state->pixels, sizeof(dec->pixels));
+	memcpy(dec->offsets, state->offsets, sizeof(dec->offsets));
+	memcpy(dec->missing, state->missing, sizeof(dec->missing));
+	memcpy(dec->steps, state->steps, sizeof(dec->steps));
+	memcpy(dec->compact, state->compact, sizeof(dec->compact));
+	char *buffer = (char *)dec->buffer;
+	memcpy(buffer, coeffs, coefficients_size(state));
+	for (int chan = 0; chan < dec->channels; ++chan) {
+		dec->coeffs[chan] = buffer;
+		buffer += dec->pixels[chan] * coefficient_size(dec->compact[chan]);
+	}
+	return 1;
+}
+
+struct image *decode_image(struct decoder *dec, unsigned char *data, long long size)
+{
+	if (decode_coefficients(dec, data, size))
+		return 0;
+	return reconstruct_image(dec);
+}
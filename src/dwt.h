@@ -6,6 +6,10 @@ Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 
 #pragma once
 
+#include <stdlib.h>
+#include <string.h>
+#include "mapping.h"
+
 void dwt(void (*wavelet)(float *, float *, int, int, int), float *out, float *in, int N0, int N, int SO, int SI)
 {
 	wavelet(out, in, N, SO, SI);
@@ -26,57 +30,138 @@ void idwt(void (*iwavelet)(float *, float *, int, int, int), float *out, float *
 		in[i*SI] = out[i*SO];
 }
 
-void dwt2(void (*wavelet)(float *, float *, int, int, int), float *out, float *in, int N0, int W, int H, int SO, int SI)
-{
-	for (int i = 0; i < H; ++i)
-		dwt(wavelet, out+SO*W*i, in+SI*W*i, N0, W, SO, SI);
-	for (int i = 0; i < W * H; ++i)
-		in[i*SI] = out[i*SO];
-	for (int i = 0; i < W; ++i)
-		dwt(wavelet, out+SO*i, in+SI*i, N0, H, SO*W, SI*W);
-}
+// the columns are transformed this many at a time, see DWT_COLUMNS
+#define DWT_STRIP 16
 
-void idwt2(void (*iwavelet)(float *, float *, int, int, int), float *out, float *in, int N0, int W, int H, int SO, int SI)
-{
-	for (int i = 0; i < W; ++i)
-		idwt(iwavelet, out+SO*i, in+SI*i, N0, H, SO*W, SI*W);
-	for (int i = 0; i < W * H; ++i)
-		in[i*SI] = out[i*SO];
-	for (int i = 0; i < H; ++i)
-		idwt(iwavelet, out+SO*W*i, in+SI*W*i, N0, W, SO, SI);
-}
+// lifting bodies of the wavelets apply each step to L adjacent lanes at once
+#define DWT_LANES(L) for (int l = 0; l < (L); ++l)
 
-void dwt2d(void (*wavelet)(float *, float *, int, int, int), float *out, float *in, int N0, int W, int H, int SO, int SI, int SW)
-{
-	for (int j = 0; j < H; ++j) {
-		wavelet(out+SO*SW*j, in+SI*SW*j, W, SO, SI);
-		for (int i = 0; i < W; ++i)
-			in[(SW*j+i)*SI] = out[(SW*j+i)*SO];
-	}
-	for (int i = 0; i < W; ++i)
-		wavelet(out+SO*i, in+SI*i, H, SO*SW, SI*SW);
-	int W2 = (W+1)/2, H2 = (H+1)/2;
-	for (int j = 0; j < H2; ++j)
-		for (int i = 0; i < W2; ++i)
-			in[(SW*j+i)*SI] = out[(SW*j+i)*SO];
-	if (W2 >= N0 && H2 >= N0)
-		dwt2d(wavelet, out, in, N0, W2, H2, SO, SI, SW);
+/*
+Specialized instances of a wavelet on samples of TYPE, given its lifting
+bodies: rows with unit strides and columns DWT_STRIP at a time with a
+stride of one row. The 2D transforms split the rows LX times and the
+columns LY times, both at the finer levels and only the longer axis at
+the coarser ones. The buffer not being transformed serves as scratch for
+the columns, so both must hold SW*H samples.
+*/
+#define DWT_INSTANCES(TYPE, WAVELET, IWAVELET, FORWARD, INVERSE) \
+void WAVELET##_unit(TYPE *out, TYPE *in, int N) FORWARD(1, 1, 1) \
+void IWAVELET##_unit(TYPE *out, TYPE *in, int N) INVERSE(1, 1, 1) \
+void WAVELET##_lanes(TYPE *out, TYPE *in, int N, long long SO, long long SI) FORWARD(DWT_STRIP, SO, SI) \
+void IWAVELET##_lanes(TYPE *out, TYPE *in, int N, long long SO, long long SI) INVERSE(DWT_STRIP, SO, SI) \
+DWT_COLUMNS(TYPE, WAVELET) \
+DWT_COLUMNS(TYPE, IWAVELET) \
+ \
+void dwt2d_##WAVELET(TYPE *out, TYPE *in, int LX, int LY, int W, int H, int SW) \
+{ \
+	for (int j = 0; j < H; ++j) \
+		if (LX > 0) \
+			WAVELET##_unit(out+(long long)SW*j, in+(long long)SW*j, W); \
+		else \
+			memcpy(out+(long long)SW*j, in+(long long)SW*j, sizeof(TYPE) * W); \
+	if (LY > 0) \
+		WAVELET##_columns(out, in, W, H, SW); \
+	int W2 = LX > 0 ? (W+1)/2 : W, H2 = LY > 0 ? (H+1)/2 : H; \
+	for (int j = 0; j < H2; ++j) \
+		for (int i = 0; i < W2; ++i) \
+			in[(long long)SW*j+i] = out[(long long)SW*j+i]; \
+	if (LX > 1 || LY > 1) \
+		dwt2d_##WAVELET(out, in, LX-1, LY-1, W2, H2, SW); \
+} \
+ \
+void idwt2d_##WAVELET(TYPE *out, TYPE *in, int LX, int LY, int W, int H, int SW) \
+{ \
+	int W2 = LX > 0 ? (W+1)/2 : W, H2 = LY > 0 ? (H+1)/2 : H; \
+	if (LX > 1 || LY > 1) \
+		idwt2d_##WAVELET(out, in, LX-1, LY-1, W2, H2, SW); \
+	if (LY > 0) \
+		IWAVELET##_columns(in, out, W, H, SW); \
+	for (int j = 0; j < H; ++j) { \
+		if (LX > 0) \
+			IWAVELET##_unit(out+(long long)SW*j, in+(long long)SW*j, W); \
+		else \
+			memcpy(out+(long long)SW*j, in+(long long)SW*j, sizeof(TYPE) * W); \
+		for (int i = 0; i < W; ++i) \
+			in[(long long)SW*j+i] = out[(long long)SW*j+i]; \
+	} \
+} \
+ \
+/* like idwt2d, but hands each row of the last level to a callback instead of storing it */ \
+void idwt2d_rows_##WAVELET(TYPE *out, TYPE *in, int LX, int LY, int W, int H, int SW, void (*row)(void *, TYPE *, int), void *ctx) \
+{ \
+	int W2 = LX > 0 ? (W+1)/2 : W, H2 = LY > 0 ? (H+1)/2 : H; \
+	if (LX > 1 || LY > 1) \
+		idwt2d_##WAVELET(out, in, LX-1, LY-1, W2, H2, SW); \
+	if (LY > 0) \
+		IWAVELET##_columns(in, out, W, H, SW); \
+	for (int j = 0; j < H; ++j) { \
+		if (LX > 0) \
+			IWAVELET##_unit(out, in+(long long)SW*j, W); \
+		else \
+			memcpy(out, in+(long long)SW*j, sizeof(TYPE) * W); \
+		row(ctx, out, j); \
+	} \
 }
 
-void idwt2d(void (*iwavelet)(float *, float *, int, int, int), float *out, float *in, int N0, int W, int H, int SO, int SI, int SW)
-{
-	int W2 = (W+1)/2, H2 = (H+1)/2;
-	if (W2 >= N0 && H2 >= N0)
-		idwt2d(iwavelet, out, in, N0, W2, H2, SO, SI, SW);
-	for (int i = 0; i < W; ++i)
-		iwavelet(out+SO*i, in+SI*i, H, SO*SW, SI*SW);
-	for (int j = 0; j < H; ++j)
-		for (int i = 0; i < W; ++i)
-			in[(SW*j+i)*SI] = out[(SW*j+i)*SO];
-	for (int j = 0; j < H; ++j) {
-		iwavelet(out+SO*SW*j, in+SI*SW*j, W, SO, SI);
-		for (int i = 0; i < W; ++i)
-			in[(SW*j+i)*SI] = out[(SW*j+i)*SO];
-	}
+/*
+Transforms the columns in place, using the SW*H samples of tmp as scratch.
+In memory, strips of DWT_STRIP columns are read straight from the rows.
+When the buffers are mapped from files, bands of as many columns as the
+resident budget allows are first gathered row by row, so each band reads
+and writes the rows front to back once instead of touching every page of
+the plane once per strip. The columns left over go through the unit
+transform, as many at a time as tmp has room for.
+*/
+#define DWT_COLUMNS(TYPE, WAVELET) \
+void WAVELET##_band(TYPE *io, TYPE *tmp, int B, int H, int SW) \
+{ \
+	TYPE *band = tmp + (long long)B * H; \
+	for (int j = 0; j < H; ++j) \
+		for (int i = 0; i < B; i += DWT_STRIP) \
+			for (int k = 0; k < DWT_STRIP; ++k) \
+				tmp[(long long)H*i+DWT_STRIP*j+k] = io[(long long)SW*j+i+k]; \
+	for (int i = 0; i < B; i += DWT_STRIP) \
+		WAVELET##_lanes(band+(long long)H*i, tmp+(long long)H*i, H, DWT_STRIP, DWT_STRIP); \
+	for (int j = 0; j < H; ++j) \
+		for (int i = 0; i < B; i += DWT_STRIP) \
+			for (int k = 0; k < DWT_STRIP; ++k) \
+				io[(long long)SW*j+i+k] = band[(long long)H*i+DWT_STRIP*j+k]; \
+} \
+ \
+void WAVELET##_columns(TYPE *io, TYPE *tmp, int W, int H, int SW) \
+{ \
+	if (SW == 1) { \
+		memcpy(tmp, io, sizeof(TYPE) * H); \
+		WAVELET##_unit(io, tmp, H); \
+		return; \
+	} \
+	long long fit = resident_budget() / (2 * sizeof(TYPE) * H); \
+	int B = fit < SW / 2 ? fit : SW / 2; \
+	B -= B % DWT_STRIP; \
+	int i = 0; \
+	if (B > DWT_STRIP) { \
+		for (int n; W - i >= DWT_STRIP; i += n) { \
+			n = W - i < B ? (W - i) / DWT_STRIP * DWT_STRIP : B; \
+			WAVELET##_band(io+i, tmp, n, H, SW); \
+		} \
+	} else { \
+		for (; i + DWT_STRIP <= W; i += DWT_STRIP) { \
+			WAVELET##_lanes(tmp, io+i, H, DWT_STRIP, SW); \
+			for (int j = 0; j < H; ++j) \
+				for (int k = 0; k < DWT_STRIP; ++k) \
+					io[(long long)SW*j+i+k] = tmp[DWT_STRIP*j+k]; \
+		} \
+	} \
+	for (int n; i < W; i += n) { \
+		n = W - i < SW / 2 ? W - i : SW / 2; \
+		TYPE *unit = tmp + (long long)n * H; \
+		for (int j = 0; j < H; ++j) \
+			for (int k = 0; k < n; ++k) \
+				tmp[(long long)H*k+j] = io[(long long)SW*j+i+k]; \
+		for (int k = 0; k < n; ++k) \
+			WAVELET##_unit(unit+(long long)H*k, tmp+(long long)H*k, H); \
+		for (int j = 0; j < H; ++j) \
+			for (int k = 0; k < n; ++k) \
+				io[(long long)SW*j+i+k] = unit[(long long)H*k+j]; \
+	} \
 }
-
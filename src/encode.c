@@ -4,227 +4,244 @@ Encoder for lossy and lossless image compression based on the discrete wavelet t
 Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 */
 
-#include "hilbert.h"
-#include "haar.h"
-#include "cdf97.h"
-#include "rint_haar.h"
-#include "utils.h"
-#include "dwt.h"
-#include "ppm.h"
-#include "rle.h"
-#include "vli.h"
-#include "bits.h"
+#include <string.h>
+#include <pthread.h>
+#include "encoder.h"
+#include "sequence.h"
+#include "picture.h"
+#include "file.h"
+#include "batch.h"
 
-void transformation(float *output, float *input, int lmin, int width, int height, int wavelet)
+void *encode_init(void)
 {
-	void (*funcs[3])(float *, float *, int, int, int) = { haar, cdf97, rint_haar };
-	dwt2d(funcs[wavelet], output, input, lmin, width, height, 1, 1, width);
+	return new_encoder(0, 0, 0);
 }
 
-void quantization(int *output, float *input, int *widths, int *heights, int *lengths, int levels)
+void encode_done(void *ctx)
 {
-	int width = widths[levels];
-	for (int y = 0; y < heights[0]; ++y) {
-		for (int x = 0; x < widths[0]; ++x) {
-			float v = input[width*y+x];
-			*output++ = nearbyintf(v);
-		}
-	}
-	for (int l = 0; l < levels; ++l) {
-		for (int i = 0; i < lengths[l+1] * lengths[l+1]; ++i) {
-			struct position pos = hilbert(lengths[l+1], i);
-			if ((pos.x >= widths[l] || pos.y >= heights[l]) &&
-			pos.x < widths[l+1] && pos.y < heights[l+1]) {
-				float v = input[width*pos.y+pos.x];
-				*output++ = truncf(v);
-			}
-		}
-	}
+	delete_encoder(ctx);
 }
 
-void copy(float *output, float *input, int width, int height, int stride)
+long long encode_job(void *ctx, int argc, char **argv)
 {
-	for (int i = 0; i < width * height; ++i)
-		output[i] = input[i*stride];
+	struct encoder *enc = ctx;
+	if (argc < 2) {
+		fprintf(stderr, "missing output file for \"%s\".\n", argv[0]);
+		return -1;
+	}
+	stats_start(enc->stats);
+	struct image *image = read_image(argv[0]);
+	if (!image)
+		return -1;
+	stats_stop(enc->stats, STAGE_READ);
+	long long capacity = 0;
+	if (argc >= 3)
+		capacity = atoll(argv[2]);
+	int wavelet = 1;
+	if (argc >= 4)
+		wavelet = parse_wavelet(argv[3]);
+	long long bytes = encode_image(enc, image, capacity, wavelet);
+	long long pixels = image->total;
+	delete_image(image);
+	if (bytes < 0)
+		return -1;
+	stats_start(enc->stats);
+	if (!write_file(argv[1], enc->data, bytes))
+		return -1;
+	stats_stop(enc->stats, STAGE_WRITE);
+	return pixels;
 }
 
-int encode(struct rle_writer *rle, int *val, int num, int plane)
+struct rendition {
+	struct encoder *enc;
+	char *name;
+	long long capacity, bytes;
+	int reduce, threaded;
+	pthread_t thread;
+};
+
+void *code_rendition(void *arg)
 {
-	int bit_mask = 1 << plane;
-	int int_bits = sizeof(int) * 8;
-	int sgn_pos = int_bits - 1;
-	int sig_pos = int_bits - 2;
-	int ref_pos = int_bits - 3;
-	int sgn_mask = 1 << sgn_pos;
-	int sig_mask = 1 << sig_pos;
-	int ref_mask = 1 << ref_pos;
-	for (int i = 0; i < num; ++i) {
-		if (!(val[i] & ref_mask)) {
-			int bit = val[i] & bit_mask;
-			int ret = put_rle(rle, bit);
-			if (ret)
-				return ret;
-			if (bit) {
-				int ret = rle_put_bit(rle, val[i] & sgn_mask);
-				if (ret)
-					return ret;
-				val[i] |= sig_mask;
-			}
-		}
-	}
-	for (int i = 0; i < num; ++i) {
-		if (val[i] & ref_mask) {
-			int bit = val[i] & bit_mask;
-			int ret = rle_put_bit(rle, bit);
-			if (ret)
-				return ret;
-		} else if (val[i] & sig_mask) {
-			val[i] ^= sig_mask | ref_mask;
-		}
-	}
+	struct rendition *rendition = arg;
+	rendition->bytes = code_image(rendition->enc, rendition->capacity);
 	return 0;
 }
 
-void encode_root(struct vli_writer *vli, int *val, int num)
+// codes the image and its renditions at lower resolutions concurrently, all from the same transformation
+long long encode_renditions(struct encoder *enc, int argc, char **argv, struct rendition *renditions, int count)
 {
-	int max = 0;
-	for (int i = 0; i < num; ++i)
-		if (max < abs(val[i]))
-			max = abs(val[i]);
-	int cnt = 1 + ilog2(max);
-	put_vli(vli, cnt);
-	for (int i = 0; cnt && i < num; ++i) {
-		vli_write_bits(vli, abs(val[i]), cnt);
-		if (val[i])
-			vli_put_bit(vli, val[i] < 0);
+	stats_start(enc->stats);
+	struct image *image = read_image(argv[0]);
+	if (!image)
+		return -1;
+	stats_stop(enc->stats, STAGE_READ);
+	long long capacity = argc >= 3 ? atoll(argv[2]) : 0;
+	int wavelet = argc >= 4 ? parse_wavelet(argv[3]) : 1;
+	if (!wavelet_supported(wavelet)) {
+		delete_image(image);
+		return -1;
 	}
-}
-
-int process(int *val, int num)
-{
-	int max = 0;
-	int int_bits = sizeof(int) * 8;
-	int sgn_pos = int_bits - 1;
-	int sig_pos = int_bits - 2;
-	int ref_pos = int_bits - 3;
-	int sgn_mask = 1 << sgn_pos;
-	int sig_mask = 1 << sig_pos;
-	int ref_mask = 1 << ref_pos;
-	int mix_mask = sgn_mask | sig_mask | ref_mask;
-	for (int i = 0; i < num; ++i) {
-		int sgn = val[i] < 0;
-		int mag = abs(val[i]);
-		if (max < mag)
-			max = mag;
-		val[i] = (sgn << sgn_pos) | (mag & ~mix_mask);
+	if (wavelet < 0)
+		wavelet = choose_wavelet(enc, image, capacity);
+	long long pixels = wavelet >= 0 && transform_image(enc, image, wavelet) ? image->total : -1;
+	delete_image(image);
+	if (pixels < 0)
+		return -1;
+	int started = 0;
+	for (; started < count; ++started) {
+		struct rendition *rendition = renditions + started;
+		struct encoder *dst = rendition->enc = new_encoder(0, 0, 0);
+		if (!dst) {
+			pixels = -1;
+			break;
+		}
+		dst->psnr = enc->psnr;
+		dst->perceptual = enc->perceptual;
+		dst->optimize = enc->optimize;
+		dst->substreams = enc->substreams;
+		dst->decorrelate = enc->decorrelate;
+		rendition->bytes = 0;
+		rendition->threaded = 0;
+		if (reduce_transform(dst, enc, rendition->reduce)) {
+			fprintf(stderr, "can not reduce \"%s\" %d times.\n", argv[0], rendition->reduce);
+			delete_encoder(dst);
+			pixels = -1;
+			break;
+		}
+	}
+	// without a thread of its own the rendition is coded right here
+	for (int i = 0; pixels >= 0 && i < started; ++i)
+		if (!(renditions[i].threaded = !pthread_create(&renditions[i].thread, 0, code_rendition, renditions + i)))
+			code_rendition(renditions + i);
+	long long bytes = pixels < 0 ? 0 : code_image(enc, capacity);
+	for (int i = 0; i < started; ++i)
+		if (renditions[i].threaded)
+			pthread_join(renditions[i].thread, 0);
+	if (bytes < 0)
+		pixels = -1;
+	for (int i = 0; i < started; ++i)
+		if (renditions[i].bytes < 0)
+			pixels = -1;
+	if (pixels >= 0) {
+		stats_start(enc->stats);
+		if (!write_file(argv[1], enc->data, bytes))
+			pixels = -1;
+		stats_stop(enc->stats, STAGE_WRITE);
+	}
+	for (int i = 0; i < started; ++i) {
+		struct rendition *rendition = renditions + i;
+		if (pixels >= 0 && !write_file(rendition->name, rendition->enc->data, rendition->bytes))
+			pixels = -1;
+		else if (pixels >= 0)
+			fprintf(stderr, "%lld bits (%lld KiB) encoded for \"%s\"\n", rendition->enc->encoded, (rendition->bytes + 512) / 1024, rendition->name);
+		delete_encoder(rendition->enc);
 	}
-	return 1 + ilog2(max);
+	return pixels;
 }
 
 int main(int argc, char **argv)
 {
-	if (argc != 3 && argc != 4 && argc != 5) {
-		fprintf(stderr, "usage: %s input.ppm output.dwt [CAPACITY] [WAVELET]\n", argv[0]);
-		return 1;
+	if (argc >= 3 && !strcmp(argv[1], "--batch")) {
+		int threads = 0;
+		if (argc == 5 && !strcmp(argv[3], "-j"))
+			threads = atoi(argv[4]);
+		else if (argc != 3)
+			goto usage;
+		return run_batch(argv[2], threads, encode_init, encode_job, encode_done);
 	}
-	struct image *image = read_ppm(argv[1]);
-	if (!image)
-		return 1;
-	int width = image->width;
-	int height = image->height;
-	int pixels = width * height;
-	int lmin = 4;
-	int lengths[16], widths[16], heights[16];
-	int levels = compute_lengths(lengths, widths, heights, width, height, lmin);
-	int pixels_root = widths[0] * heights[0];
-	int capacity = 0;
-	if (argc >= 4)
-		capacity = atoi(argv[3]);
-	int wavelet = 1;
-	if (argc >= 5)
-		wavelet = atoi(argv[4]);
-	rct_from_srgb(image);
-	for (int i = 0; i < width * height; ++i)
-		image->buffer[3*i] -= 128.f;
-	float *input = malloc(sizeof(float) * pixels);
-	float *output = malloc(sizeof(float) * pixels);
-	int *buffer = malloc(sizeof(int) * 3 * pixels);
-	for (int chan = 0; chan < 3; ++chan) {
-		copy(input, image->buffer+chan, width, height, 3);
-		transformation(output, input, lmin, width, height, wavelet);
-		quantization(buffer+chan*pixels, output, widths, heights, lengths, levels);
+	char *stats = 0;
+	float psnr = 0;
+	int perceptual = 0, optimize = 0, substreams = 0, decorrelate = 0, group = 0, count = 0;
+	struct rendition renditions[16];
+	while (argc >= 2 && argv[1][0] == '-' && argv[1][1] == '-') {
+		int args = 1;
+		if (!strcmp(argv[1], "--perceptual"))
+			perceptual = 1;
+		else if (!strcmp(argv[1], "--optimize"))
+			optimize = 1;
+		else if (!strcmp(argv[1], "--substreams"))
+			substreams = 1;
+		else if (!strcmp(argv[1], "--decorrelate"))
+			decorrelate = 1;
+		else if (argc >= 3 && !strcmp(argv[1], "--stats"))
+			stats = argv[++args];
+		else if (argc >= 3 && !strcmp(argv[1], "--psnr"))
+			psnr = atof(argv[++args]);
+		else if (argc >= 3 && !strcmp(argv[1], "--out-of-core"))
+			out_of_core(argv[++args]);
+		else if (argc >= 3 && !strcmp(argv[1], "--sequence"))
+			group = atoi(argv[++args]);
+		else if (argc >= 5 && !strcmp(argv[1], "--rendition") && count < 16) {
+			renditions[count].reduce = atoi(argv[++args]);
+			renditions[count].name = argv[++args];
+			renditions[count++].capacity = atoll(argv[++args]);
+		}
+		else
+			goto usage;
+		argv += args;
+		argc -= args;
 	}
-	delete_image(image);
-	free(input);
-	free(output);
-	int planes[3];
-	for (int chan = 0; chan < 3; ++chan)
-		planes[chan] = process(buffer+chan*pixels+pixels_root, pixels-pixels_root);
-	struct bits_writer *bits = bits_writer(argv[2], capacity);
-	if (!bits)
+	if (argc != 3 && argc != 4 && argc != 5)
+		goto usage;
+	if (group < 0 || group > 255 || (group && count) || (optimize && substreams))
+		goto usage;
+	struct encoder *enc = new_encoder(0, 0, 0);
+	if (!enc)
+		return 1;
+	enc->psnr = psnr;
+	enc->perceptual = perceptual;
+	enc->optimize = optimize;
+	enc->substreams = substreams;
+	enc->decorrelate = decorrelate;
+	if (stats && !(enc->stats = new_stats())) {
+		delete_encoder(enc);
 		return 1;
-	put_bit(bits, 0);
-	struct vli_writer *vli = vli_writer(bits);
-	put_vli(vli, wavelet);
-	put_vli(vli, width);
-	put_vli(vli, height);
-	put_vli(vli, lmin);
-	int meta_data = bits_count(bits);
-	fprintf(stderr, "%d bits for meta data\n", meta_data);
-	for (int chan = 0; chan < 3; ++chan)
-		encode_root(vli, buffer+chan*pixels, pixels_root);
-	int root_image = bits_count(bits);
-	fprintf(stderr, "%d bits for root image\n", root_image - meta_data);
-	for (int chan = 0; chan < 3; ++chan)
-		put_vli(vli, planes[chan]);
-	int planes_max = 0;
-	for (int chan = 0; chan < 3; ++chan)
-		if (planes_max < planes[chan])
-			planes_max = planes[chan];
-	int maximum = levels > planes_max ? levels : planes_max;
-	int layers_max = 2 * maximum - 1;
-	struct rle_writer *rle = rle_writer(vli);
-	if (planes_max == planes[0]) {
-		int num = widths[1] * heights[1] - pixels_root;
-		if (encode(rle, buffer+pixels_root, num, planes[0]-1))
-			goto end;
 	}
-	for (int layers = 0; layers < layers_max; ++layers) {
-		for (int l = 0, *buf = buffer+pixels_root,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l];
-		l < levels && l <= layers+1; buf += num, ++l,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l]) {
-			for (int chan = 0; chan < 1; ++chan) {
-				int plane = planes_max-1 - (layers+1-l);
-				if (plane < 0 || plane >= planes[chan])
-					continue;
-				if (encode(rle, buf+chan*pixels, num, plane))
-					goto end;
-			}
+	long long pixels;
+	if (group) {
+		long long capacity = argc >= 4 ? atoll(argv[3]) : 0;
+		int wavelet = argc >= 5 ? parse_wavelet(argv[4]) : 1;
+		if (!wavelet_supported(wavelet)) {
+			delete_encoder(enc);
+			return 1;
 		}
-		for (int l = 0, *buf = buffer+pixels_root,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l];
-		l < levels && l <= layers; buf += num, ++l,
-		num = widths[l+1] * heights[l+1] - widths[l] * heights[l]) {
-			for (int chan = 1; chan < 3; ++chan) {
-				int plane = planes_max-1 - (layers-l);
-				if (plane < 0 || plane >= planes[chan])
-					continue;
-				if (encode(rle, buf+chan*pixels, num, plane))
-					goto end;
-			}
+		if (wavelet < 0) {
+			fprintf(stderr, "automatic wavelet choice is not supported for sequences.\n");
+			delete_encoder(enc);
+			return 1;
 		}
+		long long bytes = encode_sequence(enc, argv[1], argv[2], group, capacity, wavelet);
+		if (bytes >= 0)
+			fprintf(stderr, "%lld bytes (%lld KiB) encoded\n", bytes, (bytes + 512) / 1024);
+		delete_encoder(enc);
+		return bytes < 0;
 	}
-	rle_flush(rle);
-end:
-	delete_rle_writer(rle);
-	delete_vli_writer(vli);
-	free(buffer);
-	int cnt = bits_count(bits);
-	int bytes = (cnt + 7) / 8;
-	int kib = (bytes + 512) / 1024;
-	fprintf(stderr, "%d bits (%d KiB) encoded\n", cnt, kib);
-	close_writer(bits);
-	return 0;
+	if (count)
+		pixels = encode_renditions(enc, argc - 1, argv + 1, renditions, count);
+	else
+		pixels = encode_job(enc, argc - 1, argv + 1);
+	if (stats) {
+		if (pixels >= 0 && !write_stats(enc->stats, stats))
+			pixels = -1;
+		delete_stats(enc->stats);
+	}
+	if (pixels >= 0) {
+		if (argc >= 5 && parse_wavelet(argv[4]) < 0)
+			fprintf(stderr, "wavelet %d chosen\n", enc->wavelet);
+		fprintf(stderr, "%lld bits for meta data\n", enc->meta_data);
+		fprintf(stderr, "%lld bits for root image\n", enc->root_image - enc->meta_data);
+		long long bytes = (enc->encoded + 7) / 8;
+		long long kib = (bytes + 512) / 1024;
+		fprintf(stderr, "%lld bits (%lld KiB) encoded\n", enc->encoded, kib);
+		if (psnr > 0) {
+			double mse = enc->distortion;
+			fprintf(stderr, "%.2f dB PSNR estimated\n", mse > 0 ? 10 * log10((double)enc->maxval * enc->maxval / mse) : INFINITY);
+		}
+	}
+	delete_encoder(enc);
+	return pixels < 0;
+usage:
+	fprintf(stderr, "usage: %s [--stats stats.json] [--psnr DB] [--perceptual] [--optimize|--substreams] [--decorrelate] [--out-of-core DIR] [--sequence GOF] [--rendition REDUCE output.dwt CAPACITY ...] input.ppm|input.pam|input.y4m output.dwt [CAPACITY] [WAVELET|auto]\n", argv[0]);
+	fprintf(stderr, "       %s --batch list.txt [-j THREADS]\n", argv[0]);
+	return 1;
 }
-
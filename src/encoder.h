@@ -0,0 +1,1000 @@
+/*
+Encoder for lossy and lossless image compression based on the discrete wavelet transformation
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "hilbert.h"
+#include "haar.h"
+#include "cdf97.h"
+#include "rint_haar.h"
+#include "utils.h"
+#include "dwt.h"
+#include "image.h"
+#include "rle.h"
+#include "vli.h"
+#include "bits.h"
+#include "stats.h"
+#include "coefficients.h"
+#include "mapping.h"
+
+struct encoder {
+	void *arena;
+	long long arena_size, max_pixels;
+	int max_depth, max_channels;
+	float *input, *output;
+	int *buffer;
+	void *coeffs[MAX_CHANNELS];
+	int compact[MAX_CHANNELS];
+	unsigned char *data;
+	struct bits_writer *bits;
+	struct vli_writer *vli;
+	struct rle_writer *rle;
+	struct stats *stats;
+	int width, height, maxval, sampling, wavelet, lmin, shared;
+	int channels, decorrelation, decorrelate;
+	struct video video;
+	int lengths[MAX_CHANNELS][32], widths[MAX_CHANNELS][32], heights[MAX_CHANNELS][32];
+	int levels[MAX_CHANNELS], levels_x[MAX_CHANNELS], levels_y[MAX_CHANNELS], planes[MAX_CHANNELS];
+	long long pixels[MAX_CHANNELS], offsets[MAX_CHANNELS+1];
+	int steps[MAX_CHANNELS][32], perceptual;
+	int order[MAX_CHANNELS*32*32], passes, optimize, substreams;
+	long long boundaries[MAX_CHANNELS*32*32];
+	int layers;
+	long long meta_data, root_image, encoded;
+	float psnr;
+	double distortion;
+};
+
+// returns the buffer holding the coefficients, the other one is free for use
+float *forward_transformation(float *output, float *input, int levels_x, int levels_y, int width, int height, int wavelet)
+{
+	switch (wavelet) {
+	case 0:
+		dwt2d_haar(output, input, levels_x, levels_y, width, height, width);
+		break;
+	case 1:
+		dwt2d_cdf97(output, input, levels_x, levels_y, width, height, width);
+		break;
+	default:
+		dwt2d_rint_haar(output, input, levels_x, levels_y, width, height, width);
+	}
+	return output;
+}
+
+void forward_quantization(int *output, float *input, int *widths, int *heights, int *lengths, int *steps, int levels)
+{
+	int width = widths[levels];
+	for (int y = 0; y < heights[0]; ++y) {
+		for (int x = 0; x < widths[0]; ++x) {
+			float v = input[(long long)width*y+x];
+			*output++ = nearbyintf(v);
+		}
+	}
+	struct position table[256], block[256];
+	for (int l = 0; l < levels; ++l) {
+		float factor = 16.f / steps[l];
+		int n = lengths[l+1], k = hilbert_table(table, n);
+		for (long long d = 0; d < (long long)n * n; d += 1 << 2 * k) {
+			if (!hilbert_block(block, table, n, d, k, widths[l+1], heights[l+1]))
+				continue;
+			for (int i = 0; i < 1 << 2 * k; ++i) {
+				struct position pos = block[i];
+				if ((pos.x >= widths[l] || pos.y >= heights[l]) &&
+				pos.x < widths[l+1] && pos.y < heights[l+1]) {
+					float v = input[(long long)width*pos.y+pos.x];
+					*output++ = truncf(factor * v);
+				}
+			}
+		}
+	}
+}
+
+// chan is nonzero for the chroma components
+void perceptual_steps(int *steps, int levels, int chan, int sampling)
+{
+	// step sizes in sixteenths, finest level first
+	static const int luma[4] = { 28, 20, 17, 16 };
+	static const int chroma[5] = { 64, 40, 24, 20, 16 };
+	for (int l = 0; l < levels; ++l) {
+		int finer = levels - 1 - l;
+		if (chan && sampling)
+			finer += 1;
+		if (chan)
+			steps[l] = finer < 5 ? chroma[finer] : 16;
+		else
+			steps[l] = finer < 4 ? luma[finer] : 16;
+	}
+}
+
+// decorrelation across the components: none, RCT or differences to the first component
+int decorrelation_mode(struct image *image, int decorrelate)
+{
+	if (image->sampling || image->channels == 1)
+		return 0;
+	if (image->channels == 3)
+		return 1;
+	return decorrelate ? 2 : 0;
+}
+
+void forward_copy(float *output, struct image *image, int chan, int decorrelation)
+{
+	if (decorrelation == 1)
+		rct_plane_from_srgb(output, image, chan);
+	else if (decorrelation == 2)
+		difference_plane(output, image, chan);
+	else
+		centered_plane(output, image, chan);
+}
+
+int encode(struct rle_writer *rle, int *val, long long num, int plane)
+{
+	int bit_mask = 1 << plane;
+	int int_bits = sizeof(int) * 8;
+	int sgn_pos = int_bits - 1;
+	int sig_pos = int_bits - 2;
+	int ref_pos = int_bits - 3;
+	int sgn_mask = 1 << sgn_pos;
+	int sig_mask = 1 << sig_pos;
+	int ref_mask = 1 << ref_pos;
+	for (long long i = 0; i < num; ++i) {
+		if (!(val[i] & ref_mask)) {
+			int bit = val[i] & bit_mask;
+			int ret = put_rle(rle, bit);
+			if (ret)
+				return ret;
+			if (bit) {
+				int ret = rle_put_bit(rle, val[i] & sgn_mask);
+				if (ret)
+					return ret;
+				val[i] |= sig_mask;
+			}
+		}
+	}
+	for (long long i = 0; i < num; ++i) {
+		if (val[i] & ref_mask) {
+			int bit = val[i] & bit_mask;
+			int ret = rle_put_bit(rle, bit);
+			if (ret)
+				return ret;
+		} else if (val[i] & sig_mask) {
+			val[i] ^= sig_mask | ref_mask;
+		}
+	}
+	return 0;
+}
+
+int encode16(struct rle_writer *rle, unsigned short *val, long long num, int plane)
+{
+	int bit_mask = 1 << plane;
+	int sgn_mask = 1 << 15;
+	int mag_mask = sgn_mask - 1;
+	for (long long i = 0; i < num; ++i) {
+		int mag = val[i] & mag_mask;
+		if (!(mag >> (plane + 1))) {
+			int bit = mag & bit_mask;
+			int ret = put_rle(rle, bit);
+			if (ret)
+				return ret;
+			if (bit) {
+				int ret = rle_put_bit(rle, val[i] & sgn_mask);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+	for (long long i = 0; i < num; ++i) {
+		int mag = val[i] & mag_mask;
+		if (mag >> (plane + 1)) {
+			int ret = rle_put_bit(rle, mag & bit_mask);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+int root_bits(void *val, int compact, long long num)
+{
+	int max = 0;
+	for (long long i = 0; i < num; ++i)
+		if (max < abs(coefficient_value(val, compact, i)))
+			max = abs(coefficient_value(val, compact, i));
+	return 1 + ilog2(max);
+}
+
+void encode_root(struct vli_writer *vli, void *val, int compact, long long num)
+{
+	int cnt = root_bits(val, compact, num);
+	put_vli(vli, cnt);
+	for (long long i = 0; cnt && i < num; ++i) {
+		int v = coefficient_value(val, compact, i);
+		vli_write_bits(vli, abs(v), cnt);
+		if (v)
+			vli_put_bit(vli, v < 0);
+	}
+}
+
+int forward_process(int *val, long long num)
+{
+	int max = 0;
+	int int_bits = sizeof(int) * 8;
+	int sgn_pos = int_bits - 1;
+	int sig_pos = int_bits - 2;
+	int ref_pos = int_bits - 3;
+	int sgn_mask = 1 << sgn_pos;
+	int sig_mask = 1 << sig_pos;
+	int ref_mask = 1 << ref_pos;
+	int mix_mask = sgn_mask | sig_mask | ref_mask;
+	for (long long i = 0; i < num; ++i) {
+		int sgn = val[i] < 0;
+		int mag = abs(val[i]);
+		if (max < mag)
+			max = mag;
+		val[i] = (sgn << sgn_pos) | (mag & ~mix_mask);
+	}
+	return 1 + ilog2(max);
+}
+
+float reconstructed_magnitude(int mag, int missing, int step, int wavelet)
+{
+	int val = mag >> missing << missing;
+	if (!val || (wavelet == 2 && !missing && step == 16))
+		return val;
+	return val + 0.375f * (1 << missing);
+}
+
+double pass_distortion(void *val, int compact, long long num, int plane, int step, int wavelet)
+{
+	float offset = wavelet == 2 && step == 16 ? 0.f : 0.5f;
+	double sum = 0;
+	for (long long j = 0; j < num; j += 4096) {
+		float part = 0.f;
+		for (long long i = j; i < num && i < j + 4096; ++i) {
+			int mag = coefficient_magnitude(val, compact, i);
+			if (!mag)
+				continue;
+			float before = mag + offset - reconstructed_magnitude(mag, plane + 1, step, wavelet);
+			float after = mag + offset - reconstructed_magnitude(mag, plane, step, wavelet);
+			part += before * before - after * after;
+		}
+		sum += part;
+	}
+	return sum;
+}
+
+double subband_energy(void *val, int compact, long long num, int step, int wavelet)
+{
+	double offset = wavelet == 2 && step == 16 ? 0 : 0.5;
+	double sum = 0;
+	for (long long i = 0; i < num; ++i) {
+		int mag = coefficient_magnitude(val, compact, i);
+		if (mag)
+			sum += (mag + offset) * (mag + offset);
+	}
+	return sum;
+}
+
+double subband_weight(struct encoder *enc, int chan, int level)
+{
+	double step = enc->steps[chan][level] / 16.0;
+	double weight = step * step;
+	// errors per pixel of the restored components, averaged over them
+	if (enc->decorrelation == 1 && chan)
+		weight *= 11.0 / 48.0;
+	else if (enc->decorrelation == 2 && chan)
+		weight /= enc->channels;
+	// the lossless wavelet keeps the range, so each split above the level doubles the area of a coefficient
+	for (int s = 0; enc->wavelet == 2 && s < enc->levels[chan] - 1 - level; ++s)
+		weight *= (s < enc->levels_x[chan] ? 2 : 1) * (s < enc->levels_y[chan] ? 2 : 1);
+	return weight;
+}
+
+void forward_pack(void *output, int *input, long long root, long long num)
+{
+	short *roots = output;
+	unsigned short *details = output;
+	for (long long i = 0; i < root; ++i)
+		roots[i] = input[i];
+	for (long long i = root; i < num; ++i)
+		details[i] = ((unsigned)input[i] >> 16 & 32768) | (input[i] & 32767);
+}
+
+long long encoded_bound(long long pixels, int channels, int depth)
+{
+	return channels * pixels / 8 * (depth + 8) + 1024;
+}
+
+// returns 0 and leaves the encoder without arena if it could not be allocated
+int reserve_encoder(struct encoder *enc, long long pixels, int channels, int depth)
+{
+	if (pixels <= enc->max_pixels && channels <= enc->max_channels && depth <= enc->max_depth)
+		return 1;
+	if (enc->max_pixels > pixels)
+		pixels = enc->max_pixels;
+	if (enc->max_channels > channels)
+		channels = enc->max_channels;
+	if (enc->max_depth > depth)
+		depth = enc->max_depth;
+	long long floats = align_size(sizeof(float) * pixels);
+	long long ints = align_size(sizeof(int) * channels * pixels);
+	long long size = encoded_bound(pixels, channels, depth);
+	free_large(enc->arena, enc->arena_size);
+	enc->arena_size = 2 * floats + ints + size;
+	char *arena = enc->arena = alloc_large(enc->arena_size);
+	if (!arena) {
+		enc->arena_size = 0;
+		enc->max_pixels = 0;
+		enc->max_channels = 0;
+		enc->max_depth = 0;
+		enc->bits->buf = 0;
+		enc->bits->size = 0;
+		return 0;
+	}
+	enc->input = (float *)arena;
+	enc->output = (float *)(arena + floats);
+	enc->buffer = (int *)(arena + 2 * floats);
+	enc->data = (unsigned char *)(arena + 2 * floats + ints);
+	enc->bits->buf = enc->data;
+	enc->bits->size = size;
+	enc->max_pixels = pixels;
+	enc->max_channels = channels;
+	enc->max_depth = depth;
+	return 1;
+}
+
+void delete_encoder(struct encoder *enc)
+{
+	delete_rle_writer(enc->rle);
+	delete_vli_writer(enc->vli);
+	delete_bits_writer(enc->bits);
+	free_large(enc->arena, enc->arena_size);
+	free(enc);
+}
+
+// returns 0 if the arena for width * height samples could not be allocated
+struct encoder *new_encoder(int width, int height, int maxval)
+{
+	struct encoder *enc = malloc(sizeof(struct encoder));
+	enc->arena = 0;
+	enc->arena_size = 0;
+	enc->max_pixels = 0;
+	enc->max_channels = 0;
+	enc->max_depth = 0;
+	enc->bits = bits_writer(0, 0, 0);
+	enc->vli = vli_writer(enc->bits);
+	enc->rle = rle_writer(enc->vli);
+	enc->stats = 0;
+	enc->psnr = 0;
+	enc->perceptual = 0;
+	enc->optimize = 0;
+	enc->substreams = 0;
+	enc->shared = 0;
+	enc->decorrelate = 0;
+	int depth = 1;
+	while (maxval >> depth)
+		depth++;
+	if (!reserve_encoder(enc, (long long)width * height, 3, depth)) {
+		delete_encoder(enc);
+		return 0;
+	}
+	return enc;
+}
+
+int setup_encoder(struct encoder *enc, struct image *image, int wavelet)
+{
+	if (!reserve_encoder(enc, image->total, image->channels, image->depth))
+		return 0;
+	enc->width = image->width;
+	enc->height = image->height;
+	enc->maxval = image->maxval;
+	enc->sampling = image->sampling;
+	enc->video = image->video;
+	enc->channels = image->channels;
+	enc->decorrelation = decorrelation_mode(image, enc->decorrelate);
+	enc->wavelet = wavelet;
+	int lmin = enc->lmin = 4;
+	int (*lengths)[32] = enc->lengths, (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels;
+	long long *pixels = enc->pixels, *offsets = enc->offsets;
+	offsets[0] = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		int w = plane_width(image, chan), h = plane_height(image, chan);
+		axis_levels(enc->levels_x + chan, enc->levels_y + chan, w, h, lmin);
+		levels[chan] = compute_lengths(lengths[chan], widths[chan], heights[chan], w, h, enc->levels_x[chan], enc->levels_y[chan]);
+		pixels[chan] = (long long)w * h;
+		offsets[chan+1] = offsets[chan] + pixels[chan];
+		if (enc->perceptual)
+			perceptual_steps(enc->steps[chan], levels[chan], chan && (image->sampling || enc->decorrelation == 1), image->sampling);
+		else
+			for (int l = 0; l < levels[chan]; ++l)
+				enc->steps[chan][l] = 16;
+	}
+	return 1;
+}
+
+// keeps the quantized coefficients of the channel, after those of the previous channels
+void store_channel(struct encoder *enc, int chan, int *scratch)
+{
+	long long *pixels = enc->pixels;
+	long long pixels_root = (long long)enc->widths[chan][0] * enc->heights[chan][0];
+	enc->planes[chan] = forward_process(scratch+pixels_root, pixels[chan]-pixels_root);
+	int compact = enc->compact[chan] = compact_storage(enc->planes[chan], root_bits(scratch, 0, pixels_root));
+	if (chan)
+		enc->coeffs[chan] = coefficient_address(enc->coeffs[chan-1], enc->compact[chan-1], pixels[chan-1]);
+	else
+		enc->coeffs[chan] = enc->buffer;
+	if (compact)
+		forward_pack(enc->coeffs[chan], scratch, pixels_root, pixels[chan]);
+	else
+		memcpy(enc->coeffs[chan], scratch, sizeof(int) * pixels[chan]);
+}
+
+// expects the color converted samples of the channel in enc->input
+void transform_channel(struct encoder *enc, int chan)
+{
+	int (*lengths)[32] = enc->lengths, (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels;
+	float *input = enc->input;
+	float *output = enc->output;
+	float *coeffs = forward_transformation(output, input, enc->levels_x[chan], enc->levels_y[chan], widths[chan][levels[chan]], heights[chan][levels[chan]], enc->wavelet);
+	int *scratch = (int *)(coeffs == output ? input : output);
+	stats_stop(enc->stats, STAGE_TRANSFORM);
+	forward_quantization(scratch, coeffs, widths[chan], heights[chan], lengths[chan], enc->steps[chan], levels[chan]);
+	stats_stop(enc->stats, STAGE_QUANTIZATION);
+	store_channel(enc, chan, scratch);
+	stats_stop(enc->stats, STAGE_PROCESS);
+}
+
+int transform_image(struct encoder *enc, struct image *image, int wavelet)
+{
+	if (!setup_encoder(enc, image, wavelet))
+		return 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		stats_start(enc->stats);
+		forward_copy(enc->input, image, chan, enc->decorrelation);
+		stats_stop(enc->stats, STAGE_COLOR);
+		transform_channel(enc, chan);
+	}
+	return 1;
+}
+
+/*
+Take the coarser levels of the transformed image in src, as if the image
+had been scaled down 2^reduce times before its transformation. The
+lowpass of the normalized wavelets doubles per level, so their
+coefficients are scaled back, which truncates the detail magnitudes just
+as quantizing the scaled down coefficients would.
+*/
+int reduce_transform(struct encoder *dst, struct encoder *src, int reduce)
+{
+	// only the levels splitting both axes scale the image down evenly
+	for (int chan = 0; chan < src->channels; ++chan)
+		if (reduce < 0 || reduce > src->levels_x[chan] || reduce > src->levels_y[chan])
+			return -1;
+	struct image image;
+	init_planar_image(&image, 0, src->widths[0][src->levels[0]-reduce], src->heights[0][src->levels[0]-reduce], src->channels, src->maxval, src->sampling);
+	image.video = src->video;
+	dst->decorrelate = src->decorrelate;
+	if (!setup_encoder(dst, &image, src->wavelet))
+		return -1;
+	int shift = src->wavelet == 2 ? 0 : reduce;
+	int half = shift ? 1 << (shift - 1) : 0;
+	int *scratch = (int *)dst->input;
+	for (int chan = 0; chan < dst->channels; ++chan) {
+		if (dst->levels_x[chan] != src->levels_x[chan] - reduce || dst->levels_y[chan] != src->levels_y[chan] - reduce)
+			return -1;
+		memcpy(dst->steps[chan], src->steps[chan], sizeof(dst->steps[chan]));
+		long long pixels_root = (long long)dst->widths[chan][0] * dst->heights[chan][0];
+		for (long long i = 0; i < pixels_root; ++i) {
+			int v = coefficient_value(src->coeffs[chan], src->compact[chan], i);
+			scratch[i] = v < 0 ? -((half - v) >> shift) : (half + v) >> shift;
+		}
+		for (long long i = pixels_root; i < dst->pixels[chan]; ++i) {
+			int v = coefficient_signed(src->coeffs[chan], src->compact[chan], i);
+			scratch[i] = v < 0 ? -(-v >> shift) : v >> shift;
+		}
+		store_channel(dst, chan, scratch);
+	}
+	return 0;
+}
+
+// substreams are coded concurrently, so only the passes of the main stream are counted in the statistics
+int encode_pass(struct encoder *enc, struct rle_writer *rle, double *distortion, void *buf, long long num, int chan, int level, int plane)
+{
+	int compact = enc->compact[chan];
+	struct stats *stats = rle == enc->rle ? enc->stats : 0;
+	stats_pass_begin(stats, rle->vli->bits, buf, compact, num, plane);
+	int ret = compact ? encode16(rle, buf, num, plane) : encode(rle, buf, num, plane);
+	if (enc->psnr > 0)
+		*distortion -= subband_weight(enc, chan, level) * pass_distortion(buf, compact, num, plane, enc->steps[chan][level], enc->wavelet);
+	stats_pass_end(stats, rle->vli, buf, compact, num, chan, level, plane);
+	return ret;
+}
+
+// number of layers in the fixed schedule
+int encoder_layers(struct encoder *enc, int *planes_max)
+{
+	int levels_max = 0;
+	*planes_max = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		if (*planes_max < enc->planes[chan])
+			*planes_max = enc->planes[chan];
+		if (levels_max < enc->levels[chan])
+			levels_max = enc->levels[chan];
+	}
+	int maximum = levels_max > *planes_max ? levels_max : *planes_max;
+	return 2 * maximum - 1;
+}
+
+// passes of the channels first to last-1 in the layer, where layer -1 is the first pass of the luma alone
+int encode_layer(struct encoder *enc, struct rle_writer *rle, double *distortion, int layers, int planes_max, int first, int last)
+{
+	int (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels, *planes = enc->planes;
+	for (int l = 0; l <= layers+1; ++l) {
+		for (int chan = first; chan < last && chan < 1; ++chan) {
+			int plane = planes_max-1 - (layers+1-l);
+			if (l >= levels[chan] || plane < 0 || plane >= planes[chan])
+				continue;
+			void *buf = coefficient_address(enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			if (encode_pass(enc, rle, distortion, buf, num, chan, l, plane))
+				return 1;
+		}
+	}
+	for (int l = 0; l <= layers; ++l) {
+		for (int chan = first > 1 ? first : 1; chan < last; ++chan) {
+			int plane = planes_max-1 - (layers-l);
+			if (l >= levels[chan] || plane < 0 || plane >= planes[chan])
+				continue;
+			void *buf = coefficient_address(enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			if (encode_pass(enc, rle, distortion, buf, num, chan, l, plane))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+int encode_fixed_layers(struct encoder *enc, double target)
+{
+	int planes_max, layers_max = encoder_layers(enc, &planes_max);
+	if (encode_layer(enc, enc->rle, &enc->distortion, -1, planes_max, 0, enc->channels))
+		return 1;
+	for (int layers = 0; layers < layers_max; ++layers) {
+		if (encode_layer(enc, enc->rle, &enc->distortion, layers, planes_max, 0, enc->channels))
+			return 1;
+		enc->boundaries[enc->layers++] = bits_count(enc->bits);
+		if (enc->psnr > 0 && enc->distortion <= target)
+			break;
+	}
+	return 0;
+}
+
+/*
+In the substream mode each channel is coded on a thread of its own into a
+separate stream. The layers of these substreams are then interleaved in
+chunks, which are listed in a table of their sizes ahead of them, so the
+stream stays embedded and may be truncated anywhere.
+*/
+struct substream_writer {
+	struct encoder *enc;
+	struct bits_writer bits;
+	struct vli_writer vli;
+	struct rle_writer rle;
+	int chan;
+	// bytes up to the end of each layer and the distortion left by it
+	long long ends[64];
+	double distortion[64];
+	pthread_t thread;
+};
+
+void *code_substream(void *ptr)
+{
+	struct substream_writer *sub = ptr;
+	struct encoder *enc = sub->enc;
+	int planes_max, layers_max = encoder_layers(enc, &planes_max);
+	double distortion = 0;
+	int ret = encode_layer(enc, &sub->rle, &distortion, -1, planes_max, sub->chan, sub->chan + 1);
+	for (int layers = 0; layers < layers_max; ++layers) {
+		if (!ret)
+			ret = encode_layer(enc, &sub->rle, &distortion, layers, planes_max, sub->chan, sub->chan + 1);
+		// every layer ends on a byte boundary, without zeros left to run
+		if (!ret && sub->rle.cnt > 0)
+			ret = rle_flush(&sub->rle);
+		sub->ends[layers] = bits_flush(&sub->bits);
+		sub->distortion[layers] = distortion;
+	}
+	return 0;
+}
+
+int write_substream_table(struct vli_writer *vli, struct substream_writer *subs, int channels, int rows)
+{
+	int ret = put_vli(vli, rows);
+	for (int k = 0; !ret && k < rows; ++k)
+		for (int chan = 0; !ret && chan < channels; ++chan)
+			ret = put_vli64(vli, subs[chan].ends[k] - (k ? subs[chan].ends[k-1] : 0));
+	return ret;
+}
+
+// returns -1 if the substreams could not be allocated and 1 if one did not fit into its buffer
+int code_substreams(struct encoder *enc, long long capacity, double target)
+{
+	int planes_max, layers_max = encoder_layers(enc, &planes_max);
+	int depth = 1 + ilog2(enc->maxval);
+	long long size = 0;
+	for (int chan = 0; chan < enc->channels; ++chan)
+		size += encoded_bound(enc->pixels[chan], 1, depth);
+	unsigned char *data = alloc_large(size);
+	if (!data)
+		return -1;
+	struct substream_writer subs[MAX_CHANNELS];
+	int threads[MAX_CHANNELS];
+	long long offset = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		struct substream_writer *sub = subs + chan;
+		long long bound = encoded_bound(enc->pixels[chan], 1, depth);
+		sub->enc = enc;
+		sub->chan = chan;
+		sub->bits.buf = data + offset;
+		sub->bits.size = bound;
+		reset_bits_writer(&sub->bits, 0);
+		sub->vli.bits = &sub->bits;
+		reset_vli_writer(&sub->vli);
+		sub->rle.vli = &sub->vli;
+		reset_rle_writer(&sub->rle);
+		// without a thread of its own the channel is coded right here
+		if (!(threads[chan] = !pthread_create(&sub->thread, 0, code_substream, sub)))
+			code_substream(sub);
+		offset += bound;
+	}
+	for (int chan = 0; chan < enc->channels; ++chan)
+		if (threads[chan])
+			pthread_join(subs[chan].thread, 0);
+	int overflow = 0;
+	for (int chan = 0; chan < enc->channels; ++chan)
+		overflow |= subs[chan].bits.num >= subs[chan].bits.size;
+	int rows = layers_max;
+	for (int k = 0; enc->psnr > 0 && k < layers_max; ++k) {
+		double distortion = enc->distortion;
+		for (int chan = 0; chan < enc->channels; ++chan)
+			distortion += subs[chan].distortion[k];
+		if (distortion <= target) {
+			rows = k + 1;
+			break;
+		}
+	}
+	// the last layer included may be cut short by the capacity, but not the table
+	for (; rows > 0; --rows) {
+		struct bits_writer bits = *enc->bits;
+		struct vli_writer vli = { &bits, enc->vli->order };
+		if (write_substream_table(&vli, subs, enc->channels, rows))
+			continue;
+		long long bytes = bits_flush(&bits);
+		for (int chan = 0; rows > 1 && chan < enc->channels; ++chan)
+			bytes += subs[chan].ends[rows-2];
+		if (!capacity || 8 * bytes < capacity)
+			break;
+	}
+	struct bits_writer *bits = enc->bits;
+	write_substream_table(enc->vli, subs, enc->channels, rows);
+	bits_flush(bits);
+	long long room = bits->size;
+	if (capacity > 0 && capacity / 8 < room)
+		room = capacity / 8;
+	int complete = 1;
+	for (int k = 0; k < rows; ++k) {
+		for (int chan = 0; chan < enc->channels; ++chan) {
+			long long first = k ? subs[chan].ends[k-1] : 0, num = subs[chan].ends[k] - first;
+			if (num > room - bits->num) {
+				num = room - bits->num;
+				complete = 0;
+			}
+			memcpy(bits->buf + bits->num, subs[chan].bits.buf + first, num);
+			bits->num += num;
+		}
+		if (complete)
+			enc->boundaries[enc->layers++] = bits_count(bits);
+	}
+	for (int chan = 0; rows && chan < enc->channels; ++chan)
+		enc->distortion += subs[chan].distortion[rows-1];
+	free_large(data, size);
+	return overflow;
+}
+
+double pass_bits(long long insignificant, long long significant, long long fresh)
+{
+	double bits = significant + fresh + 8;
+	if (fresh && fresh < insignificant) {
+		double p = (double)fresh / insignificant;
+		bits -= insignificant * (p * log2(p) + (1 - p) * log2(1 - p));
+	}
+	return bits;
+}
+
+int pass_statistics(struct encoder *enc, double (*gain)[32], double (*cost)[32], int *count)
+{
+	int (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels, *planes = enc->planes;
+	int groups = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		if (!planes[chan])
+			continue;
+		for (int l = 0; l < levels[chan]; ++l, ++groups) {
+			void *buf = coefficient_address(enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			long long hist[32] = { 0 };
+			for (long long i = 0; i < num; ++i) {
+				int mag = coefficient_magnitude(buf, enc->compact[chan], i);
+				if (mag)
+					++hist[ilog2(mag)];
+			}
+			double weight = subband_weight(enc, chan, l);
+			long long significant = 0;
+			for (int plane = planes[chan]-1, k = 0; plane >= 0; --plane, ++k) {
+				gain[groups][k] = weight * pass_distortion(buf, enc->compact[chan], num, plane, enc->steps[chan][l], enc->wavelet);
+				cost[groups][k] = pass_bits(num - significant, significant, hist[plane]);
+				significant += hist[plane];
+			}
+			count[groups] = planes[chan];
+		}
+	}
+	return groups;
+}
+
+void optimize_order(struct encoder *enc)
+{
+	double gain[MAX_CHANNELS*32][32], cost[MAX_CHANNELS*32][32];
+	int count[MAX_CHANNELS*32], next[MAX_CHANNELS*32], total = 0;
+	int groups = pass_statistics(enc, gain, cost, count);
+	for (int g = 0; g < groups; ++g) {
+		next[g] = 0;
+		total += count[g];
+	}
+	enc->passes = 0;
+	while (enc->passes < total) {
+		int best = -1, last = 0;
+		double ratio = -1;
+		for (int g = 0; g < groups; ++g) {
+			double G = 0, C = 0;
+			for (int k = next[g]; k < count[g]; ++k) {
+				G += gain[g][k];
+				C += cost[g][k];
+				if (ratio < G / C) {
+					ratio = G / C;
+					best = g;
+					last = k;
+				}
+			}
+		}
+		for (; next[best] <= last; ++next[best])
+			enc->order[enc->passes++] = best;
+	}
+}
+
+int encode_optimized_layers(struct encoder *enc, double target)
+{
+	int (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels, *planes = enc->planes;
+	int chans[MAX_CHANNELS*32], ls[MAX_CHANNELS*32], next[MAX_CHANNELS*32], groups = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		if (!planes[chan])
+			continue;
+		for (int l = 0; l < levels[chan]; ++l, ++groups) {
+			chans[groups] = chan;
+			ls[groups] = l;
+			next[groups] = planes[chan] - 1;
+		}
+	}
+	for (int i = 0; i < enc->passes; ++i) {
+		int g = enc->order[i], chan = chans[g], l = ls[g];
+		void *buf = coefficient_address(enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+		long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+		if (encode_pass(enc, enc->rle, &enc->distortion, buf, num, chan, l, next[g]--))
+			return 1;
+		enc->boundaries[enc->layers++] = bits_count(enc->bits);
+		if (enc->psnr > 0 && enc->distortion <= target)
+			break;
+	}
+	return 0;
+}
+
+// distortion of the transform domain before any bitplane pass is sent
+double initial_distortion(struct encoder *enc)
+{
+	int (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	double distortion = 0;
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		for (int l = 0; l < enc->levels[chan]; ++l) {
+			void *buf = coefficient_address(enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][l]*heights[chan][l]);
+			long long num = (long long)widths[chan][l+1] * heights[chan][l+1] - (long long)widths[chan][l] * heights[chan][l];
+			double floor = enc->wavelet == 2 && enc->steps[chan][l] == 16 ? 0 : num / 12.0;
+			distortion += subband_weight(enc, chan, l) * (subband_energy(buf, enc->compact[chan], num, enc->steps[chan][l], enc->wavelet) + floor);
+		}
+	}
+	return distortion;
+}
+
+// returns the bytes of the stream or -1 if it did not fit into the buffer
+long long code_image(struct encoder *enc, long long capacity)
+{
+	int (*widths)[32] = enc->widths, (*heights)[32] = enc->heights;
+	int *levels = enc->levels, *planes = enc->planes;
+	long long *offsets = enc->offsets;
+	struct bits_writer *bits = enc->bits;
+	struct vli_writer *vli = enc->vli;
+	struct rle_writer *rle = enc->rle;
+	reset_bits_writer(bits, capacity);
+	reset_vli_writer(vli);
+	reset_rle_writer(rle);
+	stats_start(enc->stats);
+	enc->layers = 0;
+	if (!enc->shared) {
+		put_bit(bits, 0);
+		put_vli(vli, enc->wavelet);
+		put_vli(vli, enc->width);
+		put_vli(vli, enc->height);
+		put_vli(vli, enc->lmin);
+		put_vli(vli, enc->maxval);
+		put_vli(vli, enc->sampling);
+		put_vli(vli, enc->channels);
+		put_vli(vli, enc->decorrelation);
+	}
+	if (enc->sampling) {
+		struct video *video = &enc->video;
+		put_vli(vli, video->rate[0]);
+		put_vli(vli, video->rate[1]);
+		put_vli(vli, video->interlace);
+		put_vli(vli, video->aspect[0]);
+		put_vli(vli, video->aspect[1]);
+		put_vli(vli, video->siting);
+	}
+	for (int chan = 0; chan < enc->channels; ++chan) {
+		put_vli(vli, enc->levels_x[chan]);
+		put_vli(vli, enc->levels_y[chan]);
+	}
+	for (int chan = 0; chan < enc->channels; ++chan)
+		for (int l = 0; l < levels[chan]; ++l)
+			put_vli(vli, enc->steps[chan][l]);
+	for (int chan = 0; chan < enc->channels; ++chan)
+		put_vli(vli, planes[chan]);
+	enc->meta_data = bits_count(bits);
+	for (int chan = 0; chan < enc->channels; ++chan)
+		encode_root(vli, enc->coeffs[chan], enc->compact[chan], (long long)widths[chan][0] * heights[chan][0]);
+	enc->root_image = bits_count(bits);
+	put_vli(vli, enc->optimize);
+	if (enc->optimize) {
+		optimize_order(enc);
+		int groups = 0;
+		for (int chan = 0; chan < enc->channels; ++chan)
+			if (planes[chan])
+				groups += levels[chan];
+		int cnt = 1 + ilog2(groups - 1);
+		for (int i = 0; i < enc->passes; ++i)
+			vli_write_bits(vli, enc->order[i], cnt);
+	} else {
+		put_vli(vli, enc->substreams);
+	}
+	long long samples = enc->decorrelation ? enc->pixels[0] : offsets[enc->channels];
+	double target = 0;
+	enc->distortion = 0;
+	if (enc->psnr > 0) {
+		target = samples * (double)enc->maxval * enc->maxval / pow(10, enc->psnr / 10);
+		enc->distortion = initial_distortion(enc);
+	}
+	int overflow = 0;
+	if (!enc->optimize && enc->substreams)
+		overflow = code_substreams(enc, capacity, target);
+	else if (!(enc->optimize ? encode_optimized_layers(enc, target) : encode_fixed_layers(enc, target)))
+		rle_flush(rle);
+	stats_stop(enc->stats, STAGE_CODING);
+	if (overflow < 0)
+		return -1;
+	// the capacity cuts streams short on purpose, the size of the buffer must not
+	if (overflow || bits->num >= bits->size) {
+		fprintf(stderr, "stream does not fit into the %lld bytes reserved for it.\n", bits->size);
+		return -1;
+	}
+	enc->encoded = bits_count(bits);
+	enc->distortion /= samples;
+	stats_finish(enc->stats, rle, enc->meta_data, enc->root_image, enc->encoded);
+	return bits_flush(bits);
+}
+
+/*
+Estimate the coded size of a center crop for every wavelet from the bitplane
+statistics of its subbands. Without capacity the smallest wins, otherwise
+the one with the least distortion left after spending the scaled capacity
+on the passes in optimized order. Returns -1 if memory ran out.
+*/
+int choose_wavelet(struct encoder *enc, struct image *image, long long capacity)
+{
+	int width = image->width < 512 ? image->width : 512;
+	int height = image->height < 512 ? image->height : 512;
+	struct image *crop = crop_image(image, (image->width - width) / 2 & ~1, (image->height - height) / 2 & ~1, width, height);
+	if (!crop)
+		return -1;
+	double budget = capacity * (double)crop->total / image->total;
+	struct stats *stats = enc->stats;
+	enc->stats = 0;
+	int best = 1;
+	double minimum = INFINITY;
+	for (int wavelet = 0; wavelet < 3; ++wavelet) {
+		if (!transform_image(enc, crop, wavelet)) {
+			best = -1;
+			break;
+		}
+		double gain[MAX_CHANNELS*32][32], cost[MAX_CHANNELS*32][32];
+		int count[MAX_CHANNELS*32];
+		int groups = pass_statistics(enc, gain, cost, count);
+		double bits = 0;
+		for (int chan = 0; chan < enc->channels; ++chan) {
+			long long num = (long long)enc->widths[chan][0] * enc->heights[chan][0];
+			bits += num * (root_bits(enc->coeffs[chan], enc->compact[chan], num) + 0.5);
+		}
+		double score;
+		if (capacity > 0) {
+			optimize_order(enc);
+			int next[MAX_CHANNELS*32] = { 0 };
+			score = initial_distortion(enc);
+			for (int i = 0; i < enc->passes; ++i) {
+				int g = enc->order[i], k = next[g]++;
+				if ((bits += cost[g][k]) > budget)
+					break;
+				score -= gain[g][k];
+			}
+		} else {
+			for (int g = 0; g < groups; ++g)
+				for (int k = 0; k < count[g]; ++k)
+					bits += cost[g][k];
+			score = bits;
+		}
+		if (score < minimum) {
+			minimum = score;
+			best = wavelet;
+		}
+	}
+	enc->stats = stats;
+	delete_image(crop);
+	return best;
+}
+
+// -1 for "auto" and -2 for anything but a number
+int parse_wavelet(char *arg)
+{
+	if (!strcmp(arg, "auto"))
+		return -1;
+	char *end;
+	long wavelet = strtol(arg, &end, 10);
+	if (end == arg || *end || wavelet < 0 || wavelet > 2)
+		return -2;
+	return wavelet;
+}
+
+// wavelets 0 to 2, or -1 to choose one automatically
+int wavelet_supported(int wavelet)
+{
+	if (wavelet < -1 || wavelet > 2) {
+		fprintf(stderr, "wavelet must be 0, 1, 2 or auto.\n");
+		return 0;
+	}
+	return 1;
+}
+
+// returns -1 if the wavelet is unknown or memory ran out
+long long encode_image(struct encoder *enc, struct image *image, long long capacity, int wavelet)
+{
+	if (!wavelet_supported(wavelet))
+		return -1;
+	if (wavelet < 0 && (wavelet = choose_wavelet(enc, image, capacity)) < 0)
+		return -1;
+	if (!transform_image(enc, image, wavelet))
+		return -1;
+	return code_image(enc, capacity);
+}
@@ -0,0 +1,50 @@
+/*
+Read and write whole files to and from memory
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+
+unsigned char *read_file(char *name, long long *size)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+		return 0;
+	}
+	long long num = 0, max = 1 << 16;
+	unsigned char *buf = malloc(max);
+	for (size_t cnt; (cnt = fread(buf + num, 1, max - num, file)) > 0;) {
+		num += cnt;
+		if (num == max)
+			buf = realloc(buf, max *= 2);
+	}
+	if (ferror(file)) {
+		fprintf(stderr, "could not read from file \"%s\".\n", name);
+		fclose(file);
+		free(buf);
+		return 0;
+	}
+	fclose(file);
+	*size = num;
+	return buf;
+}
+
+int write_file(char *name, unsigned char *buf, long long size)
+{
+	FILE *file = fopen(name, "w");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", name);
+		return 0;
+	}
+	int ok = fwrite(buf, 1, size, file) == (size_t)size;
+	if (fclose(file) || !ok) {
+		fprintf(stderr, "could not write to file \"%s\".\n", name);
+		return 0;
+	}
+	return 1;
+}
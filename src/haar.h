@@ -7,30 +7,40 @@ Copyright 2014 Ahmet Inan <xdsopl@gmail.com>
 #pragma once
 
 #include <math.h>
+#include "dwt.h"
 
-void haar(float *out, float *in, int N, int SO, int SI)
-{
-	for (int i = 0, M = N&~1, K = N+(N&1); i < M; i += 2) {
-		float ia = in[(i+0)*SI], ib = in[(i+1)*SI];
-		float oa = (ia + ib) / sqrtf(2.f);
-		float ob = (ia - ib) / sqrtf(2.f);
-		out[(i+0)/2*SO] = oa;
-		out[(i+K)/2*SO] = ob;
-	}
-	if (N&1)
-		out[(N-1)/2*SO] = in[(N-1)*SI];
+#define HAAR_FORWARD(L, SO, SI) { \
+	for (int i = 0, M = N&~1, K = N+(N&1); i < M; i += 2) { \
+		DWT_LANES(L) { \
+			float ia = in[(i+0)*SI+l], ib = in[(i+1)*SI+l]; \
+			float oa = (ia + ib) / sqrtf(2.f); \
+			float ob = (ia - ib) / sqrtf(2.f); \
+			out[(i+0)/2*SO+l] = oa; \
+			out[(i+K)/2*SO+l] = ob; \
+		} \
+	} \
+	if (N&1) \
+		DWT_LANES(L) out[(N-1)/2*SO+l] = in[(N-1)*SI+l]; \
 }
 
-void ihaar(float *out, float *in, int N, int SO, int SI)
-{
-	for (int i = 0, M = N&~1, K = N+(N&1); i < M; i += 2) {
-		float ia = in[(i+0)/2*SI], ib = in[(i+K)/2*SI];
-		float oa = (ia + ib) / sqrtf(2.f);
-		float ob = (ia - ib) / sqrtf(2.f);
-		out[(i+0)*SO] = oa;
-		out[(i+1)*SO] = ob;
-	}
-	if (N&1)
-		out[(N-1)*SO] = in[(N-1)/2*SI];
+#define HAAR_INVERSE(L, SO, SI) { \
+	for (int i = 0, M = N&~1, K = N+(N&1); i < M; i += 2) { \
+		DWT_LANES(L) { \
+			float ia = in[(i+0)/2*SI+l], ib = in[(i+K)/2*SI+l]; \
+			float oa = (ia + ib) / sqrtf(2.f); \
+			float ob = (ia - ib) / sqrtf(2.f); \
+			out[(i+0)*SO+l] = oa; \
+			out[(i+1)*SO+l] = ob; \
+		} \
+	} \
+	if (N&1) \
+		DWT_LANES(L) out[(N-1)*SO+l] = in[(N-1)/2*SI+l]; \
 }
 
+void haar(float *out, float *in, int N, int SO, int SI)
+HAAR_FORWARD(1, SO, SI)
+
+void ihaar(float *out, float *in, int N, int SO, int SI)
+HAAR_INVERSE(1, SO, SI)
+
+DWT_INSTANCES(float, haar, ihaar, HAAR_FORWARD, HAAR_INVERSE)
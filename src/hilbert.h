@@ -7,12 +7,14 @@ https://en.wikipedia.org/wiki/Hilbert_curve
 Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 */
 
+#pragma once
+
 struct position
 {
 	int x, y;
 };
 
-struct position hilbert(int n, int d)
+struct position hilbert(int n, long long d)
 {
 	int x = 0, y = 0;
 	for (int s = 1; s < n; s *= 2, d /= 4) {
@@ -33,3 +35,47 @@ struct position hilbert(int n, int d)
 	return (struct position){ x, y };
 }
 
+
+// positions of the 4^k curve indices starting at the multiple d of 4^k, using
+// the positions of a curve of size 2^k in table. Returns zero without filling
+// out, when the block lies completely outside of the rectangle w x h.
+int hilbert_block(struct position *out, struct position *table, int n, long long d, int k, int w, int h)
+{
+	int S = 1 << k;
+	int ax = 1, bx = 0, cx = 0, ay = 0, by = 1, cy = 0;
+	long long t = d >> (2 * k);
+	for (int s = S; s < n; s *= 2, t /= 4) {
+		int rx = (t/2) & 1;
+		int ry = (t^rx) & 1;
+		if (ry == 0) {
+			if (rx == 1) {
+				ax = -ax; bx = -bx; cx = s-1 - cx;
+				ay = -ay; by = -by; cy = s-1 - cy;
+			}
+			int tmp;
+			tmp = ax; ax = ay; ay = tmp;
+			tmp = bx; bx = by; by = tmp;
+			tmp = cx; cx = cy; cy = tmp;
+		}
+		cx += s * rx;
+		cy += s * ry;
+	}
+	if ((cx & ~(S-1)) >= w || (cy & ~(S-1)) >= h)
+		return 0;
+	for (int i = 0; i < S * S; ++i) {
+		out[i].x = ax * table[i].x + bx * table[i].y + cx;
+		out[i].y = ay * table[i].x + by * table[i].y + cy;
+	}
+	return 1;
+}
+
+// fills table for hilbert_block with blocks of up to 16x16 positions and returns their order k
+int hilbert_table(struct position *table, int n)
+{
+	int k = 0;
+	while (k < 4 && 2 << k <= n)
+		++k;
+	for (int i = 0; i < 1 << 2 * k; ++i)
+		table[i] = hilbert(1 << k, i);
+	return k;
+}
@@ -7,17 +7,44 @@ Copyright 2014 Ahmet Inan <xdsopl@gmail.com>
 #pragma once
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include "mapping.h"
+
+// most components of an image, for grayscale, color and multiband pictures
+enum { MAX_CHANNELS = 16 };
+
+// frame rate, interlacing as index into "ptbm", pixel aspect ratio and chroma siting of video frames
+struct video {
+	int rate[2], interlace, aspect[2], siting;
+};
 
 struct image {
 	float *buffer;
-	int width, height, total;
+	void *planes;
+	int width, height, depth;
+	long long total;
+	int channels, maxval, sampling;
+	struct video video;
 	char *name;
 };
 
+void default_video(struct video *video)
+{
+	video->rate[0] = 25;
+	video->rate[1] = 1;
+	video->interlace = 0;
+	video->aspect[0] = 1;
+	video->aspect[1] = 1;
+	video->siting = 0;
+}
+
+long long planar_image_bytes(struct image *image);
+
 void delete_image(struct image *image)
 {
 	free(image->buffer);
+	free_large(image->planes, planar_image_bytes(image));
 	free(image);
 }
 
@@ -26,12 +53,121 @@ struct image *new_image(char *name, int width, int height)
 	struct image *image = malloc(sizeof(struct image));
 	image->height = height;
 	image->width = width;
-	image->total = width * height;
+	image->total = (long long)width * height;
+	image->name = name;
+	image->buffer = malloc(3 * sizeof(float) * image->total);
+	image->planes = 0;
+	image->depth = 0;
+	image->channels = 3;
+	image->maxval = 255;
+	image->sampling = 0;
+	return image;
+}
+
+int plane_width(struct image *image, int chan)
+{
+	return chan && image->sampling ? (image->width + 1) / 2 : image->width;
+}
+
+int plane_height(struct image *image, int chan)
+{
+	return chan && image->sampling ? (image->height + 1) / 2 : image->height;
+}
+
+long long plane_offset(struct image *image, int chan)
+{
+	long long offset = 0;
+	for (int c = 0; c < chan; c++)
+		offset += (long long)plane_width(image, c) * plane_height(image, c);
+	return offset;
+}
+
+void init_planar_image(struct image *image, char *name, int width, int height, int channels, int maxval, int sampling)
+{
+	image->height = height;
+	image->width = width;
+	image->total = (long long)width * height;
 	image->name = name;
-	image->buffer = malloc(3 * sizeof(float) * width * height);
+	image->buffer = 0;
+	image->planes = 0;
+	image->channels = channels;
+	image->maxval = maxval;
+	image->sampling = sampling;
+	default_video(&image->video);
+	image->depth = 1;
+	while (maxval >> image->depth)
+		image->depth++;
+}
+
+long long planar_image_bytes(struct image *image)
+{
+	int bytes = image->depth > 8 ? sizeof(unsigned short) : sizeof(unsigned char);
+	return bytes * plane_offset(image, image->channels);
+}
+
+// returns 0 if the planes could not be allocated
+struct image *new_planar_image(char *name, int width, int height, int channels, int maxval, int sampling)
+{
+	struct image *image = malloc(sizeof(struct image));
+	init_planar_image(image, name, width, height, channels, maxval, sampling);
+	if (!(image->planes = alloc_large(planar_image_bytes(image)))) {
+		free(image);
+		return 0;
+	}
 	return image;
 }
 
+// first sample of the plane, look it up once per plane and not per sample
+void *plane_address(struct image *image, int chan)
+{
+	int bytes = image->depth > 8 ? sizeof(unsigned short) : sizeof(unsigned char);
+	return (char *)image->planes + bytes * plane_offset(image, chan);
+}
+
+int plane_sample(void *plane, int depth, long long i)
+{
+	if (depth > 8)
+		return ((unsigned short *)plane)[i];
+	return ((unsigned char *)plane)[i];
+}
+
+void set_plane_sample(void *plane, int depth, long long i, int v)
+{
+	if (depth > 8)
+		((unsigned short *)plane)[i] = v;
+	else
+		((unsigned char *)plane)[i] = v;
+}
+
+int get_sample(struct image *image, int chan, long long i)
+{
+	return plane_sample(plane_address(image, chan), image->depth, i);
+}
+
+void set_sample(struct image *image, int chan, long long i, int v)
+{
+	set_plane_sample(plane_address(image, chan), image->depth, i, v);
+}
+
+// x and y must be even for chroma subsampled images
+struct image *crop_image(struct image *image, int x, int y, int width, int height)
+{
+	struct image *crop = new_planar_image(image->name, width, height, image->channels, image->maxval, image->sampling);
+	if (!crop)
+		return 0;
+	crop->video = image->video;
+	int bytes = image->depth > 8 ? sizeof(unsigned short) : sizeof(unsigned char);
+	for (int chan = 0; chan < image->channels; ++chan) {
+		int sub = chan && image->sampling;
+		int w = plane_width(crop, chan), h = plane_height(crop, chan), stride = plane_width(image, chan);
+		char *dst = (char *)crop->planes + bytes * plane_offset(crop, chan);
+		char *src = (char *)image->planes + bytes * (plane_offset(image, chan) + (long long)stride * (y >> sub) + (x >> sub));
+		for (int j = 0; j < h; ++j)
+			memcpy(dst + (long long)bytes * w * j, src + (long long)bytes * stride * j, bytes * w);
+	}
+	return crop;
+}
+
 float fclampf(float x, float a, float b)
 {
 	return fminf(fmaxf(x, a), b);
@@ -109,31 +245,31 @@ void srgb2rct(float *io)
 
 void srgb_from_linear(struct image *image)
 {
-	for (int i = 0; i < 3 * image->total; i++)
+	for (long long i = 0; i < 3 * image->total; i++)
 		image->buffer[i] = 255.f * linear2srgb(fclampf(image->buffer[i], 0.f, 1.f));
 }
 
 void linear_from_srgb(struct image *image)
 {
-	for (int i = 0; i < 3 * image->total; i++)
+	for (long long i = 0; i < 3 * image->total; i++)
 		image->buffer[i] = srgb2linear(image->buffer[i] / 255.f);
 }
 
 void ycbcr_from_linear(struct image *image)
 {
-	for (int i = 0; i < image->total; i++)
+	for (long long i = 0; i < image->total; i++)
 		rgb2ycbcr(image->buffer + 3 * i);
 }
 
 void linear_from_ycbcr(struct image *image)
 {
-	for (int i = 0; i < image->total; i++)
+	for (long long i = 0; i < image->total; i++)
 		ycbcr2rgb(image->buffer + 3 * i);
 }
 
 void ycbcr_from_srgb(struct image *image)
 {
-	for (int i = 0; i < image->total; i++) {
+	for (long long i = 0; i < image->total; i++) {
 		for (int j = 0; j < 3; j++)
 			image->buffer[3*i+j] = srgb2linear(image->buffer[3*i+j] / 255.f);
 		rgb2ycbcr(image->buffer + 3 * i);
@@ -142,7 +278,7 @@ void ycbcr_from_srgb(struct image *image)
 
 void srgb_from_ycbcr(struct image *image)
 {
-	for (int i = 0; i < image->total; i++) {
+	for (long long i = 0; i < image->total; i++) {
 		ycbcr2rgb(image->buffer + 3 * i);
 		for (int j = 0; j < 3; j++)
 			image->buffer[3*i+j] = 255.f * linear2srgb(fclampf(image->buffer[3*i+j], 0.f, 1.f));
@@ -151,13 +287,135 @@ void srgb_from_ycbcr(struct image *image)
 
 void rct_from_srgb(struct image *image)
 {
-	for (int i = 0; i < image->total; i++)
+	for (long long i = 0; i < image->total; i++)
 		srgb2rct(image->buffer + 3 * i);
 }
 
 void srgb_from_rct(struct image *image)
 {
-	for (int i = 0; i < image->total; i++)
+	for (long long i = 0; i < image->total; i++)
 		rct2srgb(image->buffer + 3 * i);
 }
 
+
+// only for pictures with three components, see decorrelation_mode
+void rct_plane_from_srgb(float *output, struct image *image, int chan)
+{
+	int depth = image->depth, bias = 1 << (depth - 1);
+	void *red = plane_address(image, 0), *green = plane_address(image, 1), *blue = plane_address(image, 2);
+	for (long long i = 0; i < image->total; i++) {
+		int R = plane_sample(red, depth, i);
+		int G = plane_sample(green, depth, i);
+		int B = plane_sample(blue, depth, i);
+		if (chan == 0)
+			output[i] = ((R + 2 * G + B) >> 2) - bias;
+		else if (chan == 1)
+			output[i] = R - G;
+		else
+			output[i] = B - G;
+	}
+}
+
+void srgb_planes_from_rct(struct image *image, int *Y, int *U, int *V)
+{
+	int depth = image->depth, bias = 1 << (depth - 1);
+	int max = image->maxval;
+	void *red = plane_address(image, 0), *green = plane_address(image, 1), *blue = plane_address(image, 2);
+	for (long long i = 0; i < image->total; i++) {
+		int G = Y[i] + bias - ((U[i] + V[i]) >> 2);
+		int R = U[i] + G;
+		int B = V[i] + G;
+		set_plane_sample(red, depth, i, R < 0 ? 0 : R > max ? max : R);
+		set_plane_sample(green, depth, i, G < 0 ? 0 : G > max ? max : G);
+		set_plane_sample(blue, depth, i, B < 0 ? 0 : B > max ? max : B);
+	}
+}
+
+void centered_plane(float *output, struct image *image, int chan)
+{
+	int depth = image->depth, bias = 1 << (depth - 1);
+	long long total = (long long)plane_width(image, chan) * plane_height(image, chan);
+	void *plane = plane_address(image, chan);
+	for (long long i = 0; i < total; i++)
+		output[i] = plane_sample(plane, depth, i) - bias;
+}
+
+// the components after the first one as differences to it
+void difference_plane(float *output, struct image *image, int chan)
+{
+	if (!chan) {
+		centered_plane(output, image, chan);
+		return;
+	}
+	int depth = image->depth;
+	void *plane = plane_address(image, chan), *first = plane_address(image, 0);
+	for (long long i = 0; i < image->total; i++)
+		output[i] = plane_sample(plane, depth, i) - plane_sample(first, depth, i);
+}
+
+void plane_from_centered(struct image *image, int chan, int *input)
+{
+	int depth = image->depth, bias = 1 << (depth - 1);
+	int max = image->maxval;
+	long long total = (long long)plane_width(image, chan) * plane_height(image, chan);
+	void *plane = plane_address(image, chan);
+	for (long long i = 0; i < total; i++) {
+		int v = input[i] + bias;
+		set_plane_sample(plane, depth, i, v < 0 ? 0 : v > max ? max : v);
+	}
+}
+
+void store_row(struct image *image, int chan, int row, int *input)
+{
+	int width = plane_width(image, chan), max = image->maxval;
+	long long first = plane_offset(image, chan) + (long long)width * row;
+	if (image->depth > 8) {
+		unsigned short *plane = (unsigned short *)image->planes + first;
+		for (int i = 0; i < width; i++)
+			plane[i] = input[i] < 0 ? 0 : input[i] > max ? max : input[i];
+	} else {
+		unsigned char *plane = (unsigned char *)image->planes + first;
+		for (int i = 0; i < width; i++)
+			plane[i] = input[i] < 0 ? 0 : input[i] > max ? max : input[i];
+	}
+}
+
+void row_from_centered(struct image *image, int chan, int row, float *input, int *scratch)
+{
+	int bias = 1 << (image->depth - 1);
+	int width = plane_width(image, chan);
+	for (int i = 0; i < width; i++)
+		scratch[i] = nearbyintf(input[i]) + bias;
+	store_row(image, chan, row, scratch);
+}
+
+void srgb_row_from_rct(struct image *image, int row, float *Y, int *U, int *V, int *scratch)
+{
+	int bias = 1 << (image->depth - 1);
+	int width = image->width;
+	int *R = scratch, *G = scratch + width, *B = scratch + 2 * width;
+	for (int i = 0; i < width; i++) {
+		G[i] = (int)nearbyintf(Y[i]) + bias - ((U[i] + V[i]) >> 2);
+		R[i] = U[i] + G[i];
+		B[i] = V[i] + G[i];
+	}
+	store_row(image, 0, row, R);
+	store_row(image, 1, row, G);
+	store_row(image, 2, row, B);
+}
+
+void bands_row_from_differences(struct image *image, int row, float *first, int *differences, long long *offsets, int *scratch)
+{
+	int bias = 1 << (image->depth - 1);
+	int width = image->width;
+	int *base = scratch, *band = scratch + width;
+	for (int i = 0; i < width; i++)
+		base[i] = (int)nearbyintf(first[i]) + bias;
+	store_row(image, 0, row, base);
+	for (int chan = 1; chan < image->channels; chan++) {
+		int *diff = differences + offsets[chan] + (long long)width * row;
+		for (int i = 0; i < width; i++)
+			band[i] = diff[i] + base[i];
+		store_row(image, chan, row, band);
+	}
+}
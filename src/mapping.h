@@ -0,0 +1,79 @@
+/*
+Large allocations, optionally backed by memory mapped temporary files
+
+This moves the backing store out of RAM and swap. The coders walk these
+buffers front to back, and the column passes of the transforms gather
+bands of columns that fit into the resident budget, so a plane larger
+than RAM is paged through a few times per level instead of once per
+strip of columns.
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static char *temporary_directory;
+
+void out_of_core(char *directory)
+{
+	temporary_directory = directory;
+}
+
+// bytes a pass over the mapped buffers may keep resident at once, none needed in memory
+long long resident_budget(void)
+{
+	if (!temporary_directory)
+		return 0;
+	long long pages = sysconf(_SC_PHYS_PAGES), size = sysconf(_SC_PAGESIZE);
+	if (pages < 1 || size < 1)
+		return 64 << 20;
+	return pages * size / 8;
+}
+
+// returns 0 and complains on failure
+void *alloc_large(long long size)
+{
+	if (size < 1)
+		size = 1;
+	if (!temporary_directory) {
+		void *ptr = malloc(size);
+		if (!ptr)
+			fprintf(stderr, "could not allocate %lld bytes.\n", size);
+		return ptr;
+	}
+	char *path = malloc(strlen(temporary_directory) + 16);
+	sprintf(path, "%s/dwt-XXXXXX", temporary_directory);
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		fprintf(stderr, "could not create temporary file in \"%s\".\n", temporary_directory);
+		free(path);
+		return 0;
+	}
+	unlink(path);
+	free(path);
+	void *map = MAP_FAILED;
+	if (!ftruncate(fd, size))
+		map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "could not map %lld bytes of temporary file.\n", size);
+		return 0;
+	}
+	return map;
+}
+
+void free_large(void *ptr, long long size)
+{
+	if (!ptr)
+		return;
+	if (!temporary_directory)
+		free(ptr);
+	else
+		munmap(ptr, size < 1 ? 1 : size);
+}
@@ -0,0 +1,128 @@
+/*
+Picture quality metrics
+
+SSIM below uses 8x8 windows on a 4x4 grid like x264 and FFmpeg do,
+instead of the gaussian window of the original paper:
+Image quality assessment: from error visibility to structural similarity
+by Z. Wang, A. C. Bovik, H. R. Sheikh and E. P. Simoncelli - 2004
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <math.h>
+#include "image.h"
+
+void float_plane(float *output, struct image *image, int chan)
+{
+	long long total = (long long)plane_width(image, chan) * plane_height(image, chan);
+	long long offset = plane_offset(image, chan);
+	if (image->depth > 8) {
+		unsigned short *plane = (unsigned short *)image->planes + offset;
+		for (long long i = 0; i < total; i++)
+			output[i] = plane[i];
+	} else {
+		unsigned char *plane = (unsigned char *)image->planes + offset;
+		for (long long i = 0; i < total; i++)
+			output[i] = plane[i];
+	}
+}
+
+double squared_error(float *a, float *b, long long num)
+{
+	double sum = 0;
+	for (long long j = 0; j < num; j += 4096) {
+		float part = 0.f;
+		for (long long i = j; i < num && i < j + 4096; i++)
+			part += (a[i] - b[i]) * (a[i] - b[i]);
+		sum += part;
+	}
+	return sum;
+}
+
+double ssim_window(double s1, double s2, double ss, double s12, double N, double max)
+{
+	double C1 = (0.01 * max) * (0.01 * max), C2 = (0.03 * max) * (0.03 * max);
+	double m1 = s1 / N, m2 = s2 / N;
+	double vars = (ss - (s1 * s1 + s2 * s2) / N) / (N - 1);
+	double covar = (s12 - s1 * s2 / N) / (N - 1);
+	return (2 * m1 * m2 + C1) * (2 * covar + C2) / ((m1 * m1 + m2 * m2 + C1) * (vars + C2));
+}
+
+double ssim_plane(float *a, float *b, int width, int height, float max)
+{
+	int bw = width / 4, bh = height / 4;
+	if (bw < 2 || bh < 2) {
+		double s1 = 0, s2 = 0, ss = 0, s12 = 0;
+		for (long long i = 0; i < (long long)width * height; i++) {
+			s1 += a[i];
+			s2 += b[i];
+			ss += (double)a[i] * a[i] + (double)b[i] * b[i];
+			s12 += (double)a[i] * b[i];
+		}
+		return width * height > 1 ? ssim_window(s1, s2, ss, s12, width * height, max) : a[0] == b[0];
+	}
+	double *sums = malloc(sizeof(double) * 4 * 2 * bw);
+	double *prev = sums, *curr = sums + 4 * bw;
+	double total = 0;
+	for (int by = 0; by < bh; by++) {
+		for (int bx = 0; bx < bw; bx++) {
+			double s1 = 0, s2 = 0, ss = 0, s12 = 0;
+			for (int y = 4 * by; y < 4 * by + 4; y++) {
+				for (int x = 4 * bx; x < 4 * bx + 4; x++) {
+					double va = a[(long long)width*y+x], vb = b[(long long)width*y+x];
+					s1 += va;
+					s2 += vb;
+					ss += va * va + vb * vb;
+					s12 += va * vb;
+				}
+			}
+			curr[4*bx+0] = s1;
+			curr[4*bx+1] = s2;
+			curr[4*bx+2] = ss;
+			curr[4*bx+3] = s12;
+		}
+		if (by) {
+			for (int bx = 0; bx < bw - 1; bx++) {
+				double s[4];
+				for (int k = 0; k < 4; k++)
+					s[k] = prev[4*bx+k] + prev[4*bx+4+k] + curr[4*bx+k] + curr[4*bx+4+k];
+				total += ssim_window(s[0], s[1], s[2], s[3], 64, max);
+			}
+		}
+		double *tmp = prev;
+		prev = curr;
+		curr = tmp;
+	}
+	free(sums);
+	return total / ((bw - 1) * (bh - 1));
+}
+
+struct quality {
+	double psnr, ssim;
+};
+
+struct quality compare_images(struct image *a, struct image *b)
+{
+	float *fa = malloc(sizeof(float) * a->total);
+	float *fb = malloc(sizeof(float) * a->total);
+	double error = 0, ssim = 0;
+	long long samples = 0;
+	for (int chan = 0; chan < a->channels; chan++) {
+		int w = plane_width(a, chan), h = plane_height(a, chan);
+		float_plane(fa, a, chan);
+		float_plane(fb, b, chan);
+		error += squared_error(fa, fb, (long long)w * h);
+		ssim += ssim_plane(fa, fb, w, h, a->maxval) * ((double)w * h);
+		samples += (long long)w * h;
+	}
+	free(fa);
+	free(fb);
+	struct quality q;
+	double mse = error / samples;
+	q.psnr = mse > 0 ? 10 * log10((double)a->maxval * a->maxval / mse) : INFINITY;
+	q.ssim = ssim / samples;
+	return q;
+}
@@ -0,0 +1,31 @@
+/*
+Read and write picture files of any supported format
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include "ppm.h"
+#include "y4m.h"
+
+struct image *read_image(char *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+		return 0;
+	}
+	int c = fgetc(file);
+	ungetc(c, file);
+	if ('Y' == c)
+		return read_y4m_file(file, name);
+	return read_ppm_file(file, name);
+}
+
+int write_image(struct image *image)
+{
+	if (image->sampling)
+		return write_y4m(image);
+	return write_ppm(image);
+}
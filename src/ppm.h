@@ -9,22 +9,151 @@ Copyright 2014 Ahmet Inan <xdsopl@gmail.com>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "image.h"
 
-struct image *read_ppm(char *name)
+void unpack_samples(struct image *image, unsigned char *data, long long first, long long num)
 {
-	FILE *file = fopen(name, "r");
-	if (!file) {
-		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+	int channels = image->channels;
+	if (image->depth > 8) {
+		unsigned short *planes = image->planes;
+		for (int chan = 0; chan < channels; chan++) {
+			unsigned short *P = planes + image->total * chan + first;
+			unsigned char *D = data + 2 * chan;
+			for (long long i = 0; i < num; i++)
+				P[i] = (D[2*channels*i] << 8) | D[2*channels*i+1];
+		}
+	} else {
+		unsigned char *planes = image->planes;
+		if (channels == 1) {
+			memcpy(planes + first, data, num);
+			return;
+		}
+		for (int chan = 0; chan < channels; chan++) {
+			unsigned char *P = planes + image->total * chan + first;
+			for (long long i = 0; i < num; i++)
+				P[i] = data[channels*i+chan];
+		}
+	}
+}
+
+void pack_samples(unsigned char *data, struct image *image, long long first, long long num)
+{
+	int channels = image->channels;
+	if (image->depth > 8) {
+		unsigned short *planes = image->planes;
+		for (int chan = 0; chan < channels; chan++) {
+			unsigned short *P = planes + image->total * chan + first;
+			unsigned char *D = data + 2 * chan;
+			for (long long i = 0; i < num; i++) {
+				D[2*channels*i+0] = P[i] >> 8;
+				D[2*channels*i+1] = P[i];
+			}
+		}
+	} else {
+		unsigned char *planes = image->planes;
+		if (channels == 1) {
+			memcpy(data, planes + first, num);
+			return;
+		}
+		for (int chan = 0; chan < channels; chan++) {
+			unsigned char *P = planes + image->total * chan + first;
+			for (long long i = 0; i < num; i++)
+				data[channels*i+chan] = P[i];
+		}
+	}
+}
+
+int pixel_bytes(struct image *image)
+{
+	return image->channels * (image->depth > 8 ? 2 : 1);
+}
+
+int read_mapped(struct image *image, FILE *file)
+{
+	struct stat st;
+	long offset = ftell(file);
+	if (offset < 0 || fstat(fileno(file), &st) || !S_ISREG(st.st_mode))
+		return 0;
+	long long size = pixel_bytes(image) * image->total;
+	if (st.st_size < offset + size)
+		return -1;
+	void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (map == MAP_FAILED)
 		return 0;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	unpack_samples(image, (unsigned char *)map + offset, 0, image->total);
+	munmap(map, st.st_size);
+	return 1;
+}
+
+int read_chunked(struct image *image, FILE *file)
+{
+	int bytes = pixel_bytes(image);
+	int chunk = 1 << 16;
+	unsigned char *data = malloc(bytes * chunk);
+	for (long long first = 0; first < image->total; first += chunk) {
+		int num = image->total - first < chunk ? image->total - first : chunk;
+		if (fread(data, bytes, num, file) != (size_t)num) {
+			free(data);
+			return -1;
+		}
+		unpack_samples(image, data, first, num);
 	}
-	if ('P' != fgetc(file) || '6' != fgetc(file)) {
-		fprintf(stderr, "file \"%s\" not P6 image.\n", name);
+	free(data);
+	return 1;
+}
+
+// width, height, depth and maxval from the header lines of a PAM file
+int read_pam_header(FILE *file, int *integer, int *channels)
+{
+	char line[256], key[16];
+	for (int value; fgets(line, sizeof(line), file);) {
+		if (!strncmp(line, "ENDHDR", 6))
+			return 1;
+		if (sscanf(line, "%15s %d", key, &value) != 2)
+			continue;
+		if (!strcmp(key, "WIDTH"))
+			integer[0] = value;
+		else if (!strcmp(key, "HEIGHT"))
+			integer[1] = value;
+		else if (!strcmp(key, "DEPTH"))
+			*channels = value;
+		else if (!strcmp(key, "MAXVAL"))
+			integer[2] = value;
+	}
+	return 0;
+}
+
+struct image *read_ppm_file(FILE *file, char *name)
+{
+	int channels = 0, pam = 0;
+	if ('P' == fgetc(file)) {
+		switch (fgetc(file)) {
+		case '5':
+			channels = 1;
+			break;
+		case '6':
+			channels = 3;
+			break;
+		case '7':
+			pam = 1;
+			break;
+		}
+	}
+	if (!channels && !pam) {
+		fprintf(stderr, "file \"%s\" not P5, P6 or P7 image.\n", name);
 		fclose(file);
 		return 0;
 	}
-	int integer[3];
+	int integer[3] = { 0, 0, 0 };
 	struct image *image = 0;
+	if (pam) {
+		if (!read_pam_header(file, integer, &channels))
+			goto eof;
+		goto header;
+	}
 	int c = fgetc(file);
 	if (EOF == c)
 		goto eof;
@@ -49,32 +178,47 @@ struct image *read_ppm(char *name)
 		}
 		integer[i] = atoi(str);
 	}
-	if (!(integer[0] && integer[1] && integer[2])) {
+header:
+	if (!(integer[0] && integer[1] && integer[2]) || channels < 1 || channels > MAX_CHANNELS) {
 		fprintf(stderr, "could not read image file \"%s\".\n", name);
 		fclose(file);
 		return 0;
 	}
-	if (integer[2] != 255) {
-		fprintf(stderr, "cant read \"%s\", only 8 bit per channel SRGB supported at the moment.\n", name);
+	if (integer[2] > 65535) {
+		fprintf(stderr, "cant read \"%s\", only up to 16 bit per channel supported.\n", name);
 		fclose(file);
 		return 0;
 	}
-	image = new_image(name, integer[0], integer[1]);
-	for (int i = 0; i < 3 * image->total; i++) {
-		int v = fgetc(file);
-		if (EOF == v)
-			goto eof;
-		image->buffer[i] = v;
+	image = new_planar_image(name, integer[0], integer[1], channels, integer[2], 0);
+	if (!image) {
+		fclose(file);
+		return 0;
 	}
+	int ret = read_mapped(image, file);
+	if (!ret)
+		ret = read_chunked(image, file);
+	if (ret < 0)
+		goto eof;
 	fclose(file);
 	return image;
 eof:
 	fprintf(stderr, "EOF while reading from \"%s\".\n", name);
 	fclose(file);
-	delete_image(image);
+	if (image)
+		delete_image(image);
 	return 0;
 }
 
+struct image *read_ppm(char *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+		return 0;
+	}
+	return read_ppm_file(file, name);
+}
+
 int write_ppm(struct image *image)
 {
 	FILE *file = fopen(image->name, "w");
@@ -82,20 +226,34 @@ int write_ppm(struct image *image)
 		fprintf(stderr, "could not open \"%s\" file to write.\n", image->name);
 		return 0;
 	}
-	if (!fprintf(file, "P6 %d %d 255\n", image->width, image->height)) {
+	int ok;
+	if (image->channels == 1 || image->channels == 3)
+		ok = fprintf(file, "P%d %d %d %d\n", image->channels == 1 ? 5 : 6, image->width, image->height, image->maxval) > 0;
+	else
+		ok = fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nENDHDR\n", image->width, image->height, image->channels, image->maxval) > 0;
+	if (!ok) {
 		fprintf(stderr, "could not write to file \"%s\".\n", image->name);
 		fclose(file);
 		return 0;
 	}
-	for (int i = 0; i < 3 * image->total; i++) {
-		if (EOF == fputc(image->buffer[i], file))
+	int bytes = pixel_bytes(image);
+	int chunk = 1 << 16;
+	unsigned char *data = malloc(bytes * chunk);
+	for (long long first = 0; first < image->total; first += chunk) {
+		int num = image->total - first < chunk ? image->total - first : chunk;
+		pack_samples(data, image, first, num);
+		if (fwrite(data, bytes, num, file) != (size_t)num)
 			goto eof;
 	}
-	fclose(file);
+	free(data);
+	if (fclose(file)) {
+		fprintf(stderr, "could not write to file \"%s\".\n", image->name);
+		return 0;
+	}
 	return 1;
 eof:
 	fprintf(stderr, "EOF while writing to \"%s\".\n", image->name);
+	free(data);
 	fclose(file);
 	return 0;
 }
-
@@ -0,0 +1,106 @@
+/*
+Rate-distortion curve of a picture from a single encode
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "encoder.h"
+#include "decoder.h"
+#include "picture.h"
+#include "metrics.h"
+
+struct sweep {
+	struct image *image;
+	unsigned char *data;
+	long long *bytes;
+	struct quality *results;
+	int points, next;
+	pthread_mutex_t mutex;
+};
+
+void *sweep_worker(void *arg)
+{
+	struct sweep *sweep = arg;
+	struct decoder *dec = new_decoder(sweep->image->width, sweep->image->height, sweep->image->maxval);
+	while (1) {
+		pthread_mutex_lock(&sweep->mutex);
+		int point = sweep->next++;
+		pthread_mutex_unlock(&sweep->mutex);
+		if (point >= sweep->points)
+			break;
+		struct image *image = dec ? decode_image(dec, sweep->data, sweep->bytes[point]) : 0;
+		if (image) {
+			sweep->results[point] = compare_images(sweep->image, image);
+		} else {
+			sweep->results[point].psnr = NAN;
+			sweep->results[point].ssim = NAN;
+		}
+	}
+	if (dec)
+		delete_decoder(dec);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s input.ppm|input.y4m [WAVELET|auto] [BITS ...]\n", argv[0]);
+		return 1;
+	}
+	struct image *image = read_image(argv[1]);
+	if (!image)
+		return 1;
+	int wavelet = 1;
+	if (argc >= 3)
+		wavelet = parse_wavelet(argv[2]);
+	struct encoder *enc = new_encoder(image->width, image->height, image->maxval);
+	long long total = enc ? encode_image(enc, image, 0, wavelet) : -1;
+	if (total < 0) {
+		if (enc)
+			delete_encoder(enc);
+		delete_image(image);
+		return 1;
+	}
+	int count = argc > 3 ? argc - 3 : enc->layers + 1;
+	long long *bytes = malloc(sizeof(long long) * count);
+	int points = 0;
+	for (int i = 0; i < count; ++i) {
+		long long bits = argc > 3 ? atoll(argv[i+3]) : i < enc->layers ? enc->boundaries[i] : 8 * total;
+		long long num = (bits + 7) / 8;
+		if (num > total)
+			num = total;
+		if (argc > 3 || !points || bytes[points-1] != num)
+			bytes[points++] = num;
+	}
+	struct sweep sweep;
+	sweep.image = image;
+	sweep.data = enc->data;
+	sweep.bytes = bytes;
+	sweep.results = malloc(sizeof(struct quality) * points);
+	sweep.points = points;
+	sweep.next = 0;
+	pthread_mutex_init(&sweep.mutex, 0);
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > points)
+		threads = points;
+	pthread_t *pool = malloc(sizeof(pthread_t) * threads);
+	for (int i = 0; i < threads; ++i)
+		pthread_create(pool + i, 0, sweep_worker, &sweep);
+	for (int i = 0; i < threads; ++i)
+		pthread_join(pool[i], 0);
+	pthread_mutex_destroy(&sweep.mutex);
+	printf("bits,bytes,bpp,psnr,ssim\n");
+	for (int i = 0; i < points; ++i)
+		printf("%lld,%lld,%.6f,%.4f,%.6f\n", 8 * bytes[i], bytes[i], 8.0 * bytes[i] / image->total,
+			sweep.results[i].psnr, sweep.results[i].ssim);
+	free(pool);
+	free(sweep.results);
+	free(bytes);
+	delete_encoder(enc);
+	delete_image(image);
+	return 0;
+}
@@ -6,6 +6,7 @@ Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
 
 #pragma once
 
+#include <stdio.h>
 #include "vli.h"
 
 struct rle_reader {
@@ -16,8 +17,25 @@ struct rle_reader {
 struct rle_writer {
 	struct vli_writer *vli;
 	int cnt;
+#ifdef STATS
+	long long runs[32];
+#endif
 };
 
+void reset_rle_reader(struct rle_reader *rle)
+{
+	rle->cnt = 0;
+}
+
+void reset_rle_writer(struct rle_writer *rle)
+{
+	rle->cnt = 0;
+#ifdef STATS
+	for (int i = 0; i < 32; ++i)
+		rle->runs[i] = 0;
+#endif
+}
+
 struct rle_reader *rle_reader(struct vli_reader *vli)
 {
 	struct rle_reader *rle = malloc(sizeof(struct rle_reader));
@@ -30,7 +48,7 @@ struct rle_writer *rle_writer(struct vli_writer *vli)
 {
 	struct rle_writer *rle = malloc(sizeof(struct rle_writer));
 	rle->vli = vli;
-	rle->cnt = 0;
+	reset_rle_writer(rle);
 	return rle;
 }
 
@@ -57,8 +75,15 @@ int put_rle(struct rle_writer *rle, int b)
 {
 	if (rle->cnt < 0)
 		return rle->cnt;
-	if (b)
+	if (b) {
+#ifdef STATS
+		int log2 = 0;
+		while (rle->cnt >> log2)
+			++log2;
+		rle->runs[log2]++;
+#endif
 		return rle->cnt = put_vli(rle->vli, rle->cnt);
+	}
 	rle->cnt++;
 	return 0;
 }
@@ -0,0 +1,204 @@
+/*
+Sequences of frames coded in groups with a temporal wavelet transformation
+
+Layout, all numbers in little endian:
+  header: "DWTS", 4 bytes frames, group size, temporal and spatial wavelet, lmin,
+    4 bytes width, 4 bytes height, 2 bytes maxval, sampling and a zero byte
+  groups: each temporal subband as 8 bytes length followed by its encoded frame,
+    which leaves out the parameters from above, all sharing the capacity
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "encoder.h"
+#include "decoder.h"
+#include "picture.h"
+
+enum { SEQUENCE_HEADER = 24 };
+
+void temporal_transformation(float *frames, long long samples, int count, int wavelet, int inverse)
+{
+	void (*funcs[3])(float *, float *, int, int, int) = { haar, cdf97, rint_haar };
+	void (*ifuncs[3])(float *, float *, int, int, int) = { ihaar, icdf97, rint_ihaar };
+	float *tmp = malloc(sizeof(float) * 2 * count);
+	for (long long i = 0; i < samples; ++i) {
+		for (int f = 0; f < count; ++f)
+			tmp[count+f] = frames[samples*f+i];
+		if (inverse)
+			idwt(ifuncs[wavelet], tmp, tmp+count, 2, count, 1, 1);
+		else
+			dwt(funcs[wavelet], tmp, tmp+count, 2, count, 1, 1);
+		for (int f = 0; f < count; ++f)
+			frames[samples*f+i] = tmp[f];
+	}
+	free(tmp);
+}
+
+int temporal_wavelet(int wavelet)
+{
+	return wavelet == 2 ? 2 : 0;
+}
+
+long long encode_sequence(struct encoder *enc, char *input, char *output, int group, long long capacity, int wavelet)
+{
+	FILE *in = fopen(input, "r");
+	if (!in) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", input);
+		return -1;
+	}
+	int width, height;
+	struct video video;
+	if (!read_y4m_header(in, input, &width, &height, &video)) {
+		fclose(in);
+		return -1;
+	}
+	FILE *out = fopen(output, "w");
+	if (!out) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", output);
+		fclose(in);
+		return -1;
+	}
+	struct image *image = new_planar_image(input, width, height, 3, 255, 1);
+	if (!image || !setup_encoder(enc, image, wavelet)) {
+		if (image)
+			delete_image(image);
+		fclose(in);
+		fclose(out);
+		return -1;
+	}
+	image->video = video;
+	enc->shared = 1;
+	int temporal = temporal_wavelet(wavelet);
+	long long *offsets = enc->offsets, samples = offsets[3];
+	unsigned char head[SEQUENCE_HEADER] = { 'D', 'W', 'T', 'S' };
+	head[8] = group;
+	head[9] = temporal;
+	head[10] = wavelet;
+	head[11] = enc->lmin;
+	write_le(head + 12, width, 4);
+	write_le(head + 16, height, 4);
+	write_le(head + 20, image->maxval, 2);
+	head[22] = image->sampling;
+	float *frames = malloc(sizeof(float) * group * samples);
+	int ok = frames && fwrite(head, 1, SEQUENCE_HEADER, out) == SEQUENCE_HEADER;
+	long long total = 0, bytes = SEQUENCE_HEADER;
+	for (int count = group; ok && count == group; total += count) {
+		int ret = 1;
+		for (count = 0; count < group && (ret = read_y4m_frame(in, image)) > 0; ++count)
+			for (int chan = 0; chan < 3; ++chan)
+				forward_copy(frames + samples * count + offsets[chan], image, chan, enc->decorrelation);
+		if (ret < 0)
+			ok = 0;
+		if (count > 1)
+			temporal_transformation(frames, samples, count, temporal, 0);
+		// the subbands share the capacity of the group, the finest come first
+		// and pass the bits they leave unused on to the coarser ones
+		unsigned char *coded[255] = { 0 };
+		long long sizes[255] = { 0 }, left = capacity;
+		for (int t = count - 1; ok && t >= 0; --t) {
+			for (int chan = 0; chan < 3; ++chan) {
+				stats_start(enc->stats);
+				memcpy(enc->input, frames + samples * t + offsets[chan], sizeof(float) * enc->pixels[chan]);
+				transform_channel(enc, chan);
+			}
+			long long share = left / (t + 1);
+			long long num = sizes[t] = code_image(enc, capacity && share < 1 ? 1 : share);
+			left -= 8 * num;
+			if (num >= 0 && (coded[t] = malloc(num)))
+				memcpy(coded[t], enc->data, num);
+			else
+				ok = 0;
+		}
+		for (int t = 0; t < count; ++t) {
+			unsigned char length[8];
+			write_le(length, sizes[t], 8);
+			ok = ok && fwrite(length, 1, 8, out) == 8 && fwrite(coded[t], 1, sizes[t], out) == (size_t)sizes[t];
+			bytes += 8 + sizes[t];
+			free(coded[t]);
+		}
+	}
+	enc->shared = 0;
+	free(frames);
+	delete_image(image);
+	fclose(in);
+	write_le(head + 4, total, 4);
+	if (ok)
+		ok = !fseek(out, 0, SEEK_SET) && fwrite(head, 1, SEQUENCE_HEADER, out) == SEQUENCE_HEADER;
+	if (fclose(out) || !ok) {
+		fprintf(stderr, "could not encode sequence \"%s\" to \"%s\".\n", input, output);
+		return -1;
+	}
+	return bytes;
+}
+
+long long decode_sequence(struct decoder *dec, unsigned char *data, long long size, char *output)
+{
+	if (size < SEQUENCE_HEADER || memcmp(data, "DWTS", 4))
+		return -1;
+	long long total = read_le(data + 4, 4);
+	int group = data[8], temporal = data[9];
+	if (!group || temporal > 2 || data[10] > 3)
+		return -1;
+	FILE *out = fopen(output, "w");
+	if (!out) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", output);
+		return -1;
+	}
+	dec->shared = 1;
+	dec->wavelet = data[10];
+	dec->lmin = data[11];
+	dec->width = read_le(data + 12, 4);
+	dec->height = read_le(data + 16, 4);
+	dec->maxval = read_le(data + 20, 2);
+	dec->sampling = data[22];
+	dec->channels = 3;
+	dec->decorrelation = 0;
+	float *frames = 0;
+	long long pos = SEQUENCE_HEADER, samples = 0;
+	int ok = 1;
+	for (long long first = 0; ok && first < total; first += group) {
+		int count = total - first < group ? total - first : group;
+		for (int t = 0; ok && t < count; ++t) {
+			long long num = pos + 8 <= size ? read_le(data + pos, 8) : -1;
+			pos += 8;
+			if (num < 0 || num > size - pos || decode_coefficients(dec, data + pos, num)) {
+				ok = 0;
+				break;
+			}
+			pos += num;
+			if (!frames) {
+				samples = dec->offsets[3];
+				frames = malloc(sizeof(float) * group * samples);
+				if (!(ok = frames && write_y4m_header(out, &dec->image)))
+					break;
+			}
+			for (int chan = 0; chan < 3; ++chan) {
+				float *output = reconstruct_channel(dec, chan);
+				memcpy(frames + samples * t + dec->offsets[chan], output, sizeof(float) * dec->pixels[chan]);
+			}
+		}
+		if (!ok)
+			break;
+		if (count > 1)
+			temporal_transformation(frames, samples, count, temporal, 1);
+		for (int f = 0; ok && f < count; ++f) {
+			for (int chan = 0; chan < 3; ++chan) {
+				int w = dec->widths[chan][dec->levels[chan]], h = dec->heights[chan][dec->levels[chan]];
+				inverse_copy(dec->buffer + dec->offsets[chan], frames + samples * f + dec->offsets[chan], w, h);
+			}
+			ok = write_y4m_frame(out, convert_image(dec));
+		}
+	}
+	dec->shared = 0;
+	free(frames);
+	if (fclose(out) || !ok) {
+		fprintf(stderr, "could not decode sequence to \"%s\".\n", output);
+		return -1;
+	}
+	return total * dec->image.total;
+}
@@ -0,0 +1,215 @@
+/*
+Optional timing and bit allocation statistics
+
+Everything below compiles to nothing unless STATS is defined.
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "bits.h"
+#include "vli.h"
+#include "rle.h"
+#include "coefficients.h"
+
+enum { STAGE_READ, STAGE_COLOR, STAGE_TRANSFORM, STAGE_QUANTIZATION, STAGE_PROCESS, STAGE_CODING, STAGE_WRITE, STAGES };
+
+#ifdef STATS
+struct stats_pass {
+	int chan, level, plane;
+	long long significance, sign, refinement;
+	int order;
+};
+
+struct stats {
+	double wall[STAGES], cpu[STAGES];
+	double wall_start, cpu_start;
+	struct stats_pass *passes;
+	int num, max;
+	long long count, refined;
+	long long runs[32];
+	long long meta_data, root_image, encoded;
+};
+
+double stats_clock(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+long long stats_refined(void *val, int compact, long long num, int plane)
+{
+	long long cnt = 0;
+	for (long long i = 0; i < num; ++i)
+		cnt += !!(coefficient_magnitude(val, compact, i) >> plane);
+	return cnt;
+}
+#else
+struct stats;
+#endif
+
+struct stats *new_stats(void)
+{
+#ifdef STATS
+	struct stats *stats = calloc(1, sizeof(struct stats));
+	stats->max = 256;
+	stats->passes = malloc(sizeof(struct stats_pass) * stats->max);
+	return stats;
+#else
+	fprintf(stderr, "statistics not compiled in, rebuild with -DSTATS.\n");
+	return 0;
+#endif
+}
+
+void delete_stats(struct stats *stats)
+{
+#ifdef STATS
+	free(stats->passes);
+	free(stats);
+#else
+	(void)stats;
+#endif
+}
+
+void stats_start(struct stats *stats)
+{
+#ifdef STATS
+	if (!stats)
+		return;
+	stats->wall_start = stats_clock(CLOCK_MONOTONIC);
+	stats->cpu_start = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+#else
+	(void)stats;
+#endif
+}
+
+void stats_stop(struct stats *stats, int stage)
+{
+#ifdef STATS
+	if (!stats)
+		return;
+	double wall = stats_clock(CLOCK_MONOTONIC), cpu = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+	stats->wall[stage] += wall - stats->wall_start;
+	stats->cpu[stage] += cpu - stats->cpu_start;
+	stats->wall_start = wall;
+	stats->cpu_start = cpu;
+#else
+	(void)stats;
+	(void)stage;
+#endif
+}
+
+void stats_pass_begin(struct stats *stats, struct bits_writer *bits, void *val, int compact, long long num, int plane)
+{
+#ifdef STATS
+	if (!stats)
+		return;
+	stats->count = bits_count(bits);
+	stats->refined = stats_refined(val, compact, num, plane + 1);
+#else
+	(void)stats;
+	(void)bits;
+	(void)val;
+	(void)compact;
+	(void)num;
+	(void)plane;
+#endif
+}
+
+void stats_pass_end(struct stats *stats, struct vli_writer *vli, void *val, int compact, long long num, int chan, int level, int plane)
+{
+#ifdef STATS
+	if (!stats)
+		return;
+	if (stats->num >= stats->max) {
+		stats->max *= 2;
+		stats->passes = realloc(stats->passes, sizeof(struct stats_pass) * stats->max);
+	}
+	struct stats_pass *pass = stats->passes + stats->num++;
+	long long total = bits_count(vli->bits) - stats->count;
+	pass->chan = chan;
+	pass->level = level;
+	pass->plane = plane;
+	pass->refinement = stats->refined;
+	pass->sign = stats_refined(val, compact, num, plane) - stats->refined;
+	pass->significance = total - pass->sign - pass->refinement;
+	pass->order = vli->order;
+#else
+	(void)stats;
+	(void)vli;
+	(void)val;
+	(void)compact;
+	(void)num;
+	(void)chan;
+	(void)level;
+	(void)plane;
+#endif
+}
+
+void stats_finish(struct stats *stats, struct rle_writer *rle, long long meta_data, long long root_image, long long encoded)
+{
+#ifdef STATS
+	if (!stats)
+		return;
+	for (int i = 0; i < 32; ++i)
+		stats->runs[i] += rle->runs[i];
+	stats->meta_data = meta_data;
+	stats->root_image = root_image;
+	stats->encoded = encoded;
+#else
+	(void)stats;
+	(void)rle;
+	(void)meta_data;
+	(void)root_image;
+	(void)encoded;
+#endif
+}
+
+int write_stats(struct stats *stats, char *name)
+{
+#ifdef STATS
+	FILE *file = fopen(name, "w");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", name);
+		return 0;
+	}
+	char *stages[STAGES] = { "read", "color", "transform", "quantization", "process", "coding", "write" };
+	fprintf(file, "{\n\t\"stages\": [\n");
+	for (int i = 0; i < STAGES; ++i)
+		fprintf(file, "\t\t{ \"name\": \"%s\", \"wall\": %.9f, \"cpu\": %.9f }%s\n",
+			stages[i], stats->wall[i], stats->cpu[i], i < STAGES-1 ? "," : "");
+	fprintf(file, "\t],\n");
+	fprintf(file, "\t\"meta_data_bits\": %lld,\n", stats->meta_data);
+	fprintf(file, "\t\"root_image_bits\": %lld,\n", stats->root_image - stats->meta_data);
+	fprintf(file, "\t\"total_bits\": %lld,\n", stats->encoded);
+	fprintf(file, "\t\"passes\": [\n");
+	for (int i = 0; i < stats->num; ++i) {
+		struct stats_pass *p = stats->passes + i;
+		fprintf(file, "\t\t{ \"channel\": %d, \"level\": %d, \"plane\": %d, \"significance\": %lld, \"sign\": %lld, \"refinement\": %lld, \"vli_order\": %d }%s\n",
+			p->chan, p->level, p->plane, p->significance, p->sign, p->refinement, p->order, i < stats->num-1 ? "," : "");
+	}
+	fprintf(file, "\t],\n");
+	int last = 0;
+	for (int i = 0; i < 32; ++i)
+		if (stats->runs[i])
+			last = i;
+	fprintf(file, "\t\"zero_runs_log2\": [");
+	for (int i = 0; i <= last; ++i)
+		fprintf(file, "%s%lld", i ? ", " : " ", stats->runs[i]);
+	fprintf(file, " ]\n}\n");
+	if (fclose(file)) {
+		fprintf(stderr, "could not write to file \"%s\".\n", name);
+		return 0;
+	}
+	return 1;
+#else
+	(void)stats;
+	(void)name;
+	return 0;
+#endif
+}
@@ -0,0 +1,111 @@
+/*
+Synthetic test pictures
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <math.h>
+#include "image.h"
+
+unsigned synth_hash(unsigned x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+float synth_lattice(int x, int y, int seed)
+{
+	return (synth_hash(x * 73856093 ^ y * 19349663 ^ seed * 83492791) & 65535) / 65535.f;
+}
+
+float synth_value_noise(float x, float y, int seed)
+{
+	int ix = floorf(x), iy = floorf(y);
+	float fx = x - ix, fy = y - iy;
+	fx = fx * fx * (3.f - 2.f * fx);
+	fy = fy * fy * (3.f - 2.f * fy);
+	float a = synth_lattice(ix, iy, seed), b = synth_lattice(ix+1, iy, seed);
+	float c = synth_lattice(ix, iy+1, seed), d = synth_lattice(ix+1, iy+1, seed);
+	return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+void synth_noise(struct image *image)
+{
+	for (int chan = 0; chan < 3; chan++)
+		for (long long i = 0; i < image->total; i++)
+			set_sample(image, chan, i, synth_hash(chan * image->total + i) & 255);
+}
+
+void synth_gradient(struct image *image)
+{
+	int w = image->width, h = image->height;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			set_sample(image, 0, (long long)w*y+x, 255 * x / (w > 1 ? w - 1 : 1));
+			set_sample(image, 1, (long long)w*y+x, 255 * y / (h > 1 ? h - 1 : 1));
+			set_sample(image, 2, (long long)w*y+x, 255 * (x + y) / (w + h > 2 ? w + h - 2 : 1));
+		}
+	}
+}
+
+void synth_bars(struct image *image)
+{
+	static const unsigned char top[7][3] = {
+		{ 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+		{ 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 },
+	};
+	static const unsigned char mid[7][3] = {
+		{ 0, 0, 191 }, { 19, 19, 19 }, { 191, 0, 191 }, { 19, 19, 19 },
+		{ 0, 191, 191 }, { 19, 19, 19 }, { 191, 191, 191 },
+	};
+	static const unsigned char low[6][3] = {
+		{ 0, 33, 76 }, { 255, 255, 255 }, { 50, 0, 106 }, { 19, 19, 19 },
+		{ 9, 9, 9 }, { 29, 29, 29 },
+	};
+	int w = image->width, h = image->height;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const unsigned char *rgb;
+			if (3 * y < 2 * h)
+				rgb = top[7 * x / w];
+			else if (4 * y < 3 * h)
+				rgb = mid[7 * x / w];
+			else
+				rgb = low[6 * x / w];
+			for (int chan = 0; chan < 3; chan++)
+				set_sample(image, chan, (long long)w*y+x, rgb[chan]);
+		}
+	}
+}
+
+void synth_natural(struct image *image)
+{
+	int w = image->width, h = image->height;
+	float scale = 8.f / (w > h ? w : h);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			float v[3] = { 0.f, 0.f, 0.f };
+			for (int chan = 0; chan < 3; chan++) {
+				float amp = 0.5f, freq = scale;
+				for (int octave = 0; octave < 8; octave++) {
+					v[chan] += amp * synth_value_noise(x * freq, y * freq, octave + 8 * (chan != 0) + 16 * (chan == 2));
+					amp *= 0.5f;
+					freq *= 2.f;
+				}
+			}
+			float luma = v[0];
+			if (synth_value_noise(x * scale * 2.f, y * scale * 2.f, 99) > 0.6f)
+				luma = 1.f - luma;
+			for (int chan = 0; chan < 3; chan++) {
+				float c = luma + 0.35f * (v[chan] - 0.5f) * (chan != 0);
+				set_sample(image, chan, (long long)w*y+x, fclampf(255.f * c, 0.f, 255.f));
+			}
+		}
+	}
+}
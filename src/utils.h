@@ -14,21 +14,44 @@ int ilog2(int x)
 	return l;
 }
 
-int lengths_helper(int *widths, int *heights, int W, int H, int N0)
+long long align_size(long long size)
 {
-	int level = 0, W2 = (W+1)/2, H2 = (H+1)/2;
-	if (W2 >= N0 && H2 >= N0)
-		level = lengths_helper(widths, heights, W2, H2, N0);
-	widths[level] = W2;
-	heights[level] = H2;
-	return level + 1;
+	return (size + 63) & ~63;
 }
 
-int compute_lengths(int *lengths, int *widths, int *heights, int W, int H, int N0)
+/*
+Levels of the horizontal and vertical decomposition: both axes are split
+as long as both halves keep at least N0 samples, then the longer axis
+alone, so strips and panoramas do not end up with a large root image.
+*/
+void axis_levels(int *levels_x, int *levels_y, int W, int H, int N0)
+{
+	int lx = 0, ly = 0;
+	while ((W+1)/2 >= N0 || (H+1)/2 >= N0) {
+		if ((W+1)/2 >= N0) {
+			W = (W+1)/2;
+			++lx;
+		}
+		if ((H+1)/2 >= N0) {
+			H = (H+1)/2;
+			++ly;
+		}
+	}
+	if (!lx && !ly)
+		lx = ly = 1;
+	*levels_x = lx;
+	*levels_y = ly;
+}
+
+int compute_lengths(int *lengths, int *widths, int *heights, int W, int H, int levels_x, int levels_y)
 {
-	int levels = lengths_helper(widths, heights, W, H, N0);
+	int levels = levels_x > levels_y ? levels_x : levels_y;
 	widths[levels] = W;
 	heights[levels] = H;
+	for (int l = levels-1, s = 0; l >= 0; --l, ++s) {
+		widths[l] = s < levels_x ? (widths[l+1]+1)/2 : widths[l+1];
+		heights[l] = s < levels_y ? (heights[l+1]+1)/2 : heights[l+1];
+	}
 	for (int l = 0; l <= levels; ++l) {
 		int w = 1<<(ilog2(widths[l]-1)+1);
 		int h = 1<<(ilog2(heights[l]-1)+1);
@@ -37,3 +60,16 @@ int compute_lengths(int *lengths, int *widths, int *heights, int W, int H, int N
 	return levels;
 }
 
+long long read_le(unsigned char *buf, int bytes)
+{
+	long long val = 0;
+	for (int i = bytes - 1; i >= 0; --i)
+		val = (val << 8) | buf[i];
+	return val;
+}
+
+void write_le(unsigned char *buf, long long val, int bytes)
+{
+	for (int i = 0; i < bytes; ++i, val >>= 8)
+		buf[i] = val;
+}
@@ -18,6 +18,16 @@ struct vli_writer {
 	int order;
 };
 
+void reset_vli_reader(struct vli_reader *vli)
+{
+	vli->order = 0;
+}
+
+void reset_vli_writer(struct vli_writer *vli)
+{
+	vli->order = 0;
+}
+
 struct vli_reader *vli_reader(struct bits_reader *bits)
 {
 	struct vli_reader *vli = malloc(sizeof(struct vli_reader));
@@ -100,3 +110,47 @@ int get_vli(struct vli_reader *vli)
 	return val + sum;
 }
 
+
+// same code as put_vli for values up to 62 bits, the low bits written 30 at a time
+int put_vli64(struct vli_writer *vli, long long val)
+{
+	int ret;
+	while (val >= 1LL << vli->order) {
+		if ((ret = put_bit(vli->bits, 0)))
+			return ret;
+		val -= 1LL << vli->order;
+		vli->order += 1;
+	}
+	if ((ret = put_bit(vli->bits, 1)))
+		return ret;
+	for (int i = 0; i < vli->order; i += 30)
+		if ((ret = write_bits(vli->bits, val >> i & ((1 << 30) - 1), vli->order - i < 30 ? vli->order - i : 30)))
+			return ret;
+	vli->order -= 2;
+	if (vli->order < 0)
+		vli->order = 0;
+	return 0;
+}
+
+long long get_vli64(struct vli_reader *vli)
+{
+	long long sum = 0, val = 0;
+	int ret;
+	while ((ret = get_bit(vli->bits)) == 0) {
+		if (vli->order >= 62)
+			return -1;
+		sum += 1LL << vli->order;
+		vli->order += 1;
+	}
+	if (ret < 0)
+		return ret;
+	for (int i = 0, b; i < vli->order; i += 30) {
+		if ((ret = read_bits(vli->bits, &b, vli->order - i < 30 ? vli->order - i : 30)))
+			return ret;
+		val |= (long long)b << i;
+	}
+	vli->order -= 2;
+	if (vli->order < 0)
+		vli->order = 0;
+	return val + sum;
+}
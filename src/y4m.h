@@ -0,0 +1,156 @@
+/*
+Read and write YUV4MPEG2 files
+
+Copyright 2021 Ahmet Inan <xdsopl@gmail.com>
+*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "image.h"
+
+int read_y4m_line(FILE *file, char *line, int size)
+{
+	int n = 0;
+	for (int c; (c = fgetc(file)) != '\n'; line[n++] = c)
+		if (EOF == c || n >= size - 1)
+			return -1;
+	line[n] = 0;
+	return n;
+}
+
+// chroma sitings of 4:2:0 sampling, a plain C420 is the same as C420jpeg
+static const char *y4m_sitings[] = { "420jpeg", "420paldv", "420mpeg2" };
+
+int y4m_siting(char *tag)
+{
+	if (!strcmp(tag, "420"))
+		return 0;
+	for (int i = 0; i < 3; ++i)
+		if (!strcmp(tag, y4m_sitings[i]))
+			return i;
+	return -1;
+}
+
+int read_y4m_header(FILE *file, char *name, int *width, int *height, struct video *video)
+{
+	char line[256];
+	if (read_y4m_line(file, line, sizeof(line)) < 0 || strncmp(line, "YUV4MPEG2 ", 10)) {
+		fprintf(stderr, "file \"%s\" not YUV4MPEG2 stream.\n", name);
+		return 0;
+	}
+	*width = 0;
+	*height = 0;
+	default_video(video);
+	char *save;
+	for (char *tok = strtok_r(line + 10, " ", &save); tok; tok = strtok_r(0, " ", &save)) {
+		int num, den;
+		if (tok[0] == 'W') {
+			*width = atoi(tok + 1);
+		} else if (tok[0] == 'H') {
+			*height = atoi(tok + 1);
+		} else if (tok[0] == 'F' && sscanf(tok + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0) {
+			video->rate[0] = num;
+			video->rate[1] = den;
+		} else if (tok[0] == 'I' && tok[1] && strchr("ptbm", tok[1])) {
+			video->interlace = strchr("ptbm", tok[1]) - "ptbm";
+		} else if (tok[0] == 'A' && sscanf(tok + 1, "%d:%d", &num, &den) == 2 && num >= 0 && den >= 0) {
+			video->aspect[0] = num;
+			video->aspect[1] = den;
+		} else if (tok[0] == 'C') {
+			// C420p10 and the like carry more than 8 bits per sample
+			if ((video->siting = y4m_siting(tok + 1)) < 0) {
+				fprintf(stderr, "cant read \"%s\", only 8 bit 4:2:0 chroma sampling supported.\n", name);
+				return 0;
+			}
+		}
+	}
+	if (*width <= 0 || *height <= 0) {
+		fprintf(stderr, "could not read image file \"%s\".\n", name);
+		return 0;
+	}
+	return 1;
+}
+
+int read_y4m_frame(FILE *file, struct image *image)
+{
+	char line[256];
+	int c = fgetc(file);
+	if (EOF == c)
+		return 0;
+	ungetc(c, file);
+	size_t size = plane_offset(image, 3);
+	if (read_y4m_line(file, line, sizeof(line)) < 0 || strncmp(line, "FRAME", 5) ||
+	fread(image->planes, 1, size, file) != size) {
+		fprintf(stderr, "EOF while reading from \"%s\".\n", image->name);
+		return -1;
+	}
+	return 1;
+}
+
+struct image *read_y4m_file(FILE *file, char *name)
+{
+	int width, height;
+	struct video video;
+	if (!read_y4m_header(file, name, &width, &height, &video)) {
+		fclose(file);
+		return 0;
+	}
+	struct image *image = new_planar_image(name, width, height, 3, 255, 1);
+	if (!image) {
+		fclose(file);
+		return 0;
+	}
+	image->video = video;
+	int ret = read_y4m_frame(file, image);
+	if (ret <= 0) {
+		if (!ret)
+			fprintf(stderr, "EOF while reading from \"%s\".\n", name);
+		fclose(file);
+		delete_image(image);
+		return 0;
+	}
+	fclose(file);
+	return image;
+}
+
+struct image *read_y4m(char *name)
+{
+	FILE *file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to read.\n", name);
+		return 0;
+	}
+	return read_y4m_file(file, name);
+}
+
+int write_y4m_header(FILE *file, struct image *image)
+{
+	struct video *video = &image->video;
+	return fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d I%c A%d:%d C%s\n", image->width, image->height,
+		video->rate[0], video->rate[1], "ptbm"[video->interlace], video->aspect[0], video->aspect[1],
+		y4m_sitings[video->siting]) > 0;
+}
+
+int write_y4m_frame(FILE *file, struct image *image)
+{
+	size_t size = plane_offset(image, 3);
+	return fprintf(file, "FRAME\n") > 0 && fwrite(image->planes, 1, size, file) == size;
+}
+
+int write_y4m(struct image *image)
+{
+	FILE *file = fopen(image->name, "w");
+	if (!file) {
+		fprintf(stderr, "could not open \"%s\" file to write.\n", image->name);
+		return 0;
+	}
+	int ok = write_y4m_header(file, image) && write_y4m_frame(file, image);
+	if (fclose(file) || !ok) {
+		fprintf(stderr, "could not write to file \"%s\".\n", image->name);
+		return 0;
+	}
+	return 1;
+}